@@ -1,88 +1,300 @@
 #include "rtcommon.h"
 
 // My additions
+#include "benchmark.h"
 #include "image.h"
+#include "integrator.h"
+#include "render_context.h"
+#include "render_options.h"
 #include "scene.h"
+#include "scene_loader.h"
+#include "tile_scheduler.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <string>
 
-#include "external/thread_pool.h"
-
-color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
-	hit_record rec;
-
-	// If we've exceeded the ray bounce limit, no more light is gathered.
-	if (depth <= 0)
-		return color(0, 0, 0);
-
-	// If the ray hits nothing, return the background color.
-	if (!world.hit(r, 0.001, infinity, rec))
-		return background;
-
-	ray scattered;
-	color attenuation;
-	color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-	if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-		return emitted;
+// Radiance along a camera ray with the integrator the scene asked for
+color trace_sample(const render_context& ctx, const ray& r, const primary_hit* primary = nullptr) {
+	switch (ctx.integrator) {
+	case integrator_type::recursive:
+		return ray_color(r, ctx.background, ctx.world, ctx.max_depth);
+	case integrator_type::iterative:
+		if (ctx.compiled)
+			return ray_color_iterative(r, ctx.background, *ctx.compiled, ctx.max_depth, ctx.roulette_depth, primary);
+		return ray_color_iterative(r, ctx.background, virtual_world(ctx.world), ctx.max_depth, ctx.roulette_depth, primary);
+	default:
+		if (ctx.compiled)
+			return ray_color_nee(r, ctx.background, *ctx.compiled, ctx.lights, ctx.max_depth, ctx.roulette_depth, primary);
+		return ray_color_nee(r, ctx.background, virtual_world(ctx.world), ctx.lights, ctx.max_depth, ctx.roulette_depth, primary);
+	}
+}
 
-	return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
+// Every pixel gets its own random stream per pass, so the image does not depend
+// on the number of threads or the order in which tiles get rendered
+void seed_pixel_rng(const render_context& ctx, const int pass, const int j, const int i) {
+	seed_thread_rng(ctx.seed ^ mix_seed(pass), static_cast<uint64_t>(j) * ctx.image_width + i);
 }
 
 color render_pixel(
-	shared_ptr<camera> cam,
-	color& background,
-	hittable_list& world,
-	const int max_depth,
-	const int samples_per_pixel,
-	const int image_height,
-	const int image_width,
+	const render_context& ctx,
+	const int pass,
+	const int samples,
 	const int j,
-	const int i) {
+	const int i,
+	double& luminance_square_sum) {
 	color pixel_color(0, 0, 0);
+	luminance_square_sum = 0;
+
+	seed_pixel_rng(ctx, pass, j, i);
 
-	for (int s = 0; s < samples_per_pixel; ++s) {
-		auto u = (i + random_double()) / (image_width - 1);
-		auto v = (j + random_double()) / (image_height - 1);
-		ray r = cam->get_ray(u, v);
-		pixel_color += ray_color(r, background, world, max_depth);
+	for (int s = 0; s < samples; ++s) {
+		auto u = (i + random_double()) / (ctx.image_width - 1);
+		auto v = (j + random_double()) / (ctx.image_height - 1);
+		ray r = ctx.cam.get_ray(u, v);
+		color sample = trace_sample(ctx, r);
+		pixel_color += sample;
+		luminance_square_sum += luminance(sample) * luminance(sample);
 	}
 
 	return pixel_color;
 }
 
-void render_line(
-	shared_ptr<camera> cam,
-	color& background,
-	hittable_list& world,
+// render_pixel for a 2x2 block of pixels, lane k being pixel (i + k % 2, j + k / 2).
+// Per sample, the four camera rays are intersected with the world as one packet;
+// the rest of each path is traced on its own. Every lane keeps the random
+// stream render_pixel would use, so both give the same image unless a
+// primitive draws random numbers while being intersected (participating media).
+void render_quad(
+	const render_context& ctx,
+	const int pass,
+	const int samples,
+	const int j,
+	const int i,
+	const int active,
+	color* pixel_color,
+	double* luminance_square_sum) {
+	pcg32 lane_rng[ray_packet::size];
+	for (int lane = 0; lane < ray_packet::size; lane++) {
+		pixel_color[lane] = color(0, 0, 0);
+		luminance_square_sum[lane] = 0;
+		if (active & (1 << lane)) {
+			seed_pixel_rng(ctx, pass, j + lane / 2, i + lane % 2);
+			lane_rng[lane] = thread_rng();
+		}
+	}
+
+	// Primitives that sample during intersection draw from a stream of their own
+	pcg32 packet_rng(mix_seed(ctx.seed ^ mix_seed(pass)), static_cast<uint64_t>(j) * ctx.image_width + i);
+
+	for (int s = 0; s < samples; ++s) {
+		ray_packet packet;
+		for (int lane = 0; lane < ray_packet::size; lane++) {
+			// Inactive lanes still need a valid ray, they are masked out of every test
+			if (!(active & (1 << lane))) {
+				packet.set(lane, ray(point3(0, 0, 0), vec3(1, 1, 1)));
+				continue;
+			}
+			thread_rng() = lane_rng[lane];
+			auto u = (i + lane % 2 + random_double()) / (ctx.image_width - 1);
+			auto v = (j + lane / 2 + random_double()) / (ctx.image_height - 1);
+			packet.set(lane, ctx.cam.get_ray(u, v));
+			lane_rng[lane] = thread_rng();
+		}
+
+		const real unbounded = std::numeric_limits<real>::infinity();
+		real t_max[ray_packet::size] = { unbounded, unbounded, unbounded, unbounded };
+		hit_record recs[ray_packet::size];
+		thread_rng() = packet_rng;
+		int hits = ctx.world.hit_packet(packet, active, 0.001, t_max, recs);
+		packet_rng = thread_rng();
+
+		for (int lane = 0; lane < ray_packet::size; lane++) {
+			if (!(active & (1 << lane)))
+				continue;
+			thread_rays_traced++;
+
+			primary_hit primary;
+			primary.hit = (hits & (1 << lane)) != 0;
+			primary.rec = std::move(recs[lane]);
+
+			thread_rng() = lane_rng[lane];
+			color sample = trace_sample(ctx, packet.rays[lane], &primary);
+			lane_rng[lane] = thread_rng();
+
+			pixel_color[lane] += sample;
+			luminance_square_sum[lane] += luminance(sample) * luminance(sample);
+		}
+	}
+}
+
+// Returns the number of pixels that were sampled, adaptive sampling skips converged ones
+int render_tile(
+	const render_context& ctx,
 	image* img,
-	const int max_depth,
-	const int samples_per_pixel,
-	const int line,
-	const int image_height,
-	const int image_width) {
-	for (int i = 0; i < image_width; i++) {
-		color pixel_color = render_pixel(cam, background, world, max_depth, samples_per_pixel, image_height, image_width, line, i);
-		img->set_color(image_height - line - 1, i, pixel_color);
+	std::atomic<unsigned long long>* rays_traced,
+	const int pass,
+	const int samples,
+	const tile& t) {
+	auto rays_before = thread_rays_traced;
+	int pixels_sampled = 0;
+
+	auto pixel_done = [&](int j, int i) {
+		return ctx.adaptive_sampling && img->is_converged(ctx.image_height - j - 1, i);
+	};
+
+	if (ctx.packet_tracing) {
+		for (int j = t.y0; j < t.y1; j += 2) {
+			for (int i = t.x0; i < t.x1; i += 2) {
+				int active = 0;
+				for (int lane = 0; lane < ray_packet::size; lane++) {
+					int pj = j + lane / 2, pi = i + lane % 2;
+					if (pj < t.y1 && pi < t.x1 && !pixel_done(pj, pi))
+						active |= 1 << lane;
+				}
+				if (!active)
+					continue;
+
+				color pixel_color[ray_packet::size];
+				double luminance_square_sum[ray_packet::size];
+				render_quad(ctx, pass, samples, j, i, active, pixel_color, luminance_square_sum);
+
+				for (int lane = 0; lane < ray_packet::size; lane++) {
+					if (active & (1 << lane)) {
+						int y = ctx.image_height - (j + lane / 2) - 1;
+						img->add_samples(y, i + lane % 2, pixel_color[lane], luminance_square_sum[lane], samples);
+						pixels_sampled++;
+					}
+				}
+			}
+		}
+	}
+	else {
+		for (int j = t.y0; j < t.y1; j++) {
+			for (int i = t.x0; i < t.x1; i++) {
+				if (pixel_done(j, i))
+					continue;
+
+				double luminance_square_sum;
+				color pixel_color = render_pixel(ctx, pass, samples, j, i, luminance_square_sum);
+				img->add_samples(ctx.image_height - j - 1, i, pixel_color, luminance_square_sum, samples);
+				pixels_sampled++;
+			}
+		}
+	}
+
+	*rays_traced += thread_rays_traced - rays_before;
+	return pixels_sampled;
+}
+
+// Renders every compiled-in scene on one thread, once through the virtual
+// objects and once through a compiled_scene, and compares the ray rates.
+// Both take the same random streams, so the images only differ where the
+// order in which primitives are tested matters: media draw a random number
+// for every boundary they are tested against, and equally close hits may be
+// resolved differently. The two alternate for a few rounds and the fastest
+// round of each counts, which evens out caches, clock speed and other load.
+// Run with --bench-dispatch [width [samples]].
+void run_dispatch_benchmark(int width, int samples) {
+	default_bvh_options().report_stats = false;
+	std::cout << "scene                virtual Mrays/s  switch Mrays/s  speedup  virtual prims  differing pixels\n";
+
+	for (const char* name : builtin_scene_names) {
+		scene s;
+		make_builtin_scene(name, s);
+		int height = std::max(1, static_cast<int>(width / s.aspect_ratio));
+
+		camera cam(s.lookfrom, s.lookat, s.vup, s.vfov, s.aspect_ratio, 0.0, s.dist_to_focus, 0.0, 1.0);
+		render_context ctx(s.world, cam);
+		ctx.background = s.background;
+		ctx.image_width = width;
+		ctx.image_height = height;
+		ctx.samples_per_pixel = samples;
+		ctx.max_depth = s.max_depth;
+		ctx.seed = s.seed;
+		ctx.lights = collect_lights(s.world);
+		// The recursive integrator has no compiled path
+		ctx.integrator = s.integrator == integrator_type::recursive ? integrator_type::iterative : s.integrator;
+		ctx.roulette_depth = s.roulette_depth;
+
+		compiled_scene compiled(s.world, 0.0, 1.0);
+
+		const int rounds = 3;
+		std::vector<color> pixels[2];
+		double mrays[2] = { 0, 0 };
+		for (int round = 0; round < rounds; round++) {
+			for (int mode = 0; mode < 2; mode++) {
+				ctx.compiled = mode == 1 ? &compiled : nullptr;
+				pixels[mode].resize(static_cast<size_t>(width) * height);
+
+				auto rays_before = thread_rays_traced;
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int j = 0; j < height; j++) {
+					for (int i = 0; i < width; i++) {
+						double luminance_square_sum;
+						pixels[mode][static_cast<size_t>(j) * width + i] = render_pixel(ctx, 0, samples, j, i, luminance_square_sum);
+					}
+				}
+				auto stop = std::chrono::high_resolution_clock::now();
+				double seconds = std::chrono::duration<double>(stop - start).count();
+				mrays[mode] = std::max(mrays[mode], (thread_rays_traced - rays_before) / seconds / 1e6);
+			}
+		}
+
+		int differing = 0;
+		for (size_t k = 0; k < pixels[0].size(); k++) {
+			const color& a = pixels[0][k];
+			const color& b = pixels[1][k];
+			if (a.x() != b.x() || a.y() != b.y() || a.z() != b.z())
+				differing++;
+		}
+
+		std::ostringstream line;
+		line.setf(std::ios::fixed);
+		line.precision(2);
+		line << std::left << std::setw(21) << name << std::right
+			<< std::setw(15) << mrays[0] << std::setw(16) << mrays[1]
+			<< std::setw(8) << mrays[1] / mrays[0] << "x"
+			<< std::setw(15) << compiled.stats.virtual_primitives
+			<< std::setw(18) << differing << "\n";
+		std::cout << line.str() << std::flush;
 	}
 }
 
 class renderer {
 public:
-	renderer() {};
+	renderer() : img(nullptr), scene_loaded(false), stop_requested(false), finished(false) {};
+
+	// Sets up the scene named on the command line: a JSON scene file or the
+	// name of a compiled-in scene
+	bool load_scene(const std::string& name)
+	{
+		auto setup_start = std::chrono::high_resolution_clock::now();
+		bool is_file = name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0;
+		if (is_file)
+			scene_loaded = load_scene_file(name, render_scene);
+		else if (!(scene_loaded = make_builtin_scene(name, render_scene)))
+			std::cerr << "ERROR: Unknown scene '" << name << "'.\n";
+		setup_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - setup_start).count();
+		return scene_loaded;
+	}
 
 	void render() {
 		finished = false;
+		stop_requested = false;
 
 		double aspect_ratio = 16.0 / 9.0;
 		int image_width = 400;
 		int samples_per_pixel = 200;
 		int max_depth = 50;
+		uint64_t seed = 0;
 
-		scene render_scene;
 		hittable_list world;
 
 		point3 lookfrom;
@@ -92,15 +304,31 @@ public:
 		color background(0, 0, 0);
 
 		// Create the scene
-		render_scene = avatar_scene();
-		//render_scene = avatar_enhanced_scene();
-		//render_scene = random_scene();
-		//render_scene = two_perlin_spheres_scene();
-		//render_scene = earth_scene();
-		//render_scene = simple_light_scene();
-		//render_scene = cornell_box_scene();
-		//render_scene = cornell_smoke_scene();
-		//render_scene = final_scene();
+		auto setup_start = std::chrono::high_resolution_clock::now();
+
+		// A scene loaded from a file takes the place of the compiled-in ones
+		if (!scene_loaded) {
+			render_scene = avatar_scene();
+			//render_scene = avatar_enhanced_scene();
+			//render_scene = random_scene();
+			//render_scene = two_perlin_spheres_scene();
+			//render_scene = earth_scene();
+			//render_scene = simple_light_scene();
+			//render_scene = cornell_box_scene();
+			//render_scene = cornell_smoke_scene();
+			//render_scene = mesh_scene();
+			//render_scene = instancing_scene();
+			//render_scene = final_scene();
+		}
+
+		auto setup_stop = std::chrono::high_resolution_clock::now();
+		if (!scene_loaded) {
+			setup_seconds = std::chrono::duration<double>(setup_stop - setup_start).count();
+			std::cout << "Scene setup took " << setup_seconds * 1000 << " ms\n";
+		}
+
+		// Command line settings win over the scene's
+		apply_render_options(options, render_scene);
 
 		// Get the scene's objects
 		world = render_scene.world;
@@ -110,6 +338,7 @@ public:
 		aspect_ratio = render_scene.aspect_ratio;
 		samples_per_pixel = render_scene.samples_per_pixel;
 		max_depth = render_scene.max_depth;
+		seed = render_scene.seed;
 
 		background = render_scene.background;
 		lookfrom = render_scene.lookfrom;
@@ -119,39 +348,142 @@ public:
 		// Camera
 		vec3 vup = render_scene.vup;
 		auto dist_to_focus = render_scene.dist_to_focus;
-		int image_height = static_cast<int>(image_width / aspect_ratio);
-
-		shared_ptr<camera> cam = make_shared<camera>(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+		int image_height = options.height > 0 ? options.height : static_cast<int>(image_width / aspect_ratio);
+		// A height from the command line sets the shape of the image, and so of the view
+		if (options.height > 0)
+			aspect_ratio = static_cast<double>(image_width) / image_height;
+
+		camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+
+		// Shared by all render tasks, which only ever read it
+		render_context ctx(world, cam);
+		ctx.background = background;
+		ctx.image_width = image_width;
+		ctx.image_height = image_height;
+		ctx.samples_per_pixel = samples_per_pixel;
+		ctx.max_depth = max_depth;
+		ctx.seed = seed;
+		ctx.lights = collect_lights(world);
+		ctx.integrator = render_scene.integrator;
+		ctx.roulette_depth = render_scene.roulette_depth;
+		ctx.adaptive_sampling = render_scene.adaptive_sampling;
+		ctx.min_samples = render_scene.min_samples;
+		ctx.adaptive_threshold = render_scene.adaptive_threshold;
+
+		// The recursive integrator always traces its camera rays itself
+		simd_level simd = detect_simd_level();
+		select_simd_level(simd);
+		ctx.packet_tracing = render_scene.packet_tracing && ctx.integrator != integrator_type::recursive;
+
+		// Same time range as the camera's shutter
+		std::unique_ptr<compiled_scene> compiled;
+		if (render_scene.static_dispatch && ctx.integrator != integrator_type::recursive) {
+			compiled.reset(new compiled_scene(world, 0.0, 1.0));
+			ctx.compiled = compiled.get();
+		}
 
 		// Render
 		img = new image(image_width, image_height, samples_per_pixel);
 
-		int num_threads = std::thread::hardware_concurrency() - 1;
-		thread_pool pool(num_threads);
+		// Interactive runs leave one core for the input loop; always render on at least one thread
+		int num_threads = options.threads > 0 ? options.threads
+			: std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - (options.headless ? 0 : 1));
+		tile_scheduler scheduler(image_width, image_height, render_scene.tile_size, num_threads);
 
 		std::cout << "Rendering on " << num_threads << " threads\n";
 		std::cout << "W: " << image_width << " H: " << image_height << "\n";
 		std::cout << "Samples per pixel: " << samples_per_pixel << std::endl;
+		if (ctx.integrator == integrator_type::nee)
+			std::cout << "Sampling " << ctx.lights.objects.size() << " lights directly\n";
+		if (ctx.packet_tracing)
+			std::cout << "Packet tracing camera rays, " << simd_level_name(kernel_simd_level(simd)) << " box tests\n";
+
+		// Progressive mode renders the whole frame in passes of a few samples each,
+		// so the image is complete (if noisy) after the first pass and the render
+		// can stop at any point. Without it, all samples are taken in one pass.
+		int pass_samples = render_scene.pass_samples > 0
+			? std::min(render_scene.pass_samples, samples_per_pixel)
+			: samples_per_pixel;
+		double time_budget = render_scene.time_budget;
+
+		if (pass_samples < samples_per_pixel)
+			std::cout << "Progressive: " << pass_samples << " samples per pass\n";
+		if (time_budget > 0)
+			std::cout << "Time budget: " << time_budget << " seconds\n";
+		if (ctx.adaptive_sampling)
+			std::cout << "Adaptive: " << ctx.min_samples << " to " << samples_per_pixel
+				<< " samples per pixel, threshold " << ctx.adaptive_threshold << "\n";
+
+		// split into tiles
+		std::atomic<unsigned long long> rays_traced(0);
+		auto render_start = std::chrono::high_resolution_clock::now();
+
+		// The budget only applies once the first pass is done, so that a budget
+		// too short for one pass still yields a complete (if noisy) image
+		int samples_done = 0;
+		auto out_of_time = [&]() {
+			if (stop_requested)
+				return true;
+			if (time_budget <= 0 || samples_done == 0)
+				return false;
+			auto elapsed = std::chrono::high_resolution_clock::now() - render_start;
+			return std::chrono::duration<double>(elapsed).count() >= time_budget;
+		};
+
+		for (int pass = 0; samples_done < samples_per_pixel && !out_of_time(); pass++) {
+			int samples = std::min(pass_samples, samples_per_pixel - samples_done);
+			std::atomic<int> pixels_sampled(0);
+			std::atomic<bool> cut_short(false);
+
+			scheduler.run([&, pass, samples](const tile& t) {
+				// Once the budget is used up, the remaining tiles of the pass are skipped
+				if (!out_of_time())
+					pixels_sampled += render_tile(ctx, img, &rays_traced, pass, samples, t);
+				else
+					cut_short = true;
+			});
+
+			// Only passes that reached every tile count as done
+			if (cut_short)
+				break;
+
+			// With adaptive sampling, every pixel may have converged before the maximum
+			if (pixels_sampled == 0)
+				break;
+
+			samples_done += samples;
+
+			// Convergence is only decided between passes, while no tile writes to the image
+			if (ctx.adaptive_sampling
+				&& img->update_convergence(ctx.min_samples, ctx.adaptive_threshold) == 0)
+				break;
+		}
 
-		// split by lines
-		std::vector<std::future<void>> results;
-		for (int j = 0; j < image_height; j++) {
-			results.emplace_back(
-				pool.enqueue(
-					render_line,
-					cam,
-					background,
-					world,
-					img,
-					max_depth,
-					samples_per_pixel,
-					j,
-					image_height,
-					image_width));
-		}
-
-		for (auto&& result : results)
-			result.get();
+		auto render_stop = std::chrono::high_resolution_clock::now();
+		double render_seconds = std::chrono::duration<double>(render_stop - render_start).count();
+		std::cout << "\nTook " << samples_done << " of " << samples_per_pixel << " samples per pixel";
+		if (samples_done < samples_per_pixel || stop_requested)
+			std::cout << " (stopped early)";
+		if (ctx.adaptive_sampling)
+			std::cout << ", " << (double)img->samples_completed / img->num_pixels_total << " on average";
+		std::cout << "\nTraced " << rays_traced << " rays, "
+			<< rays_traced / render_seconds / 1e6 << " Mrays/sec" << std::endl;
+
+		scheduler.print_timings(std::cout);
+		// Interactive runs always keep the tile timings, batch jobs only when asked to
+		std::string timings_file = options.timings.empty() && !options.headless ? "tile_timings.csv" : options.timings;
+		if (!timings_file.empty())
+			scheduler.write_timings(timings_file);
+
+		stats.width = image_width;
+		stats.height = image_height;
+		stats.samples_per_pixel = samples_per_pixel;
+		stats.samples_done = samples_done;
+		stats.average_samples = img->num_pixels_total > 0 ? (double)img->samples_completed / img->num_pixels_total : 0;
+		stats.stopped_early = samples_done < samples_per_pixel || stop_requested;
+		stats.threads = num_threads;
+		stats.render_seconds = render_seconds;
+		stats.rays_traced = rays_traced;
 
 		save_image();
 		finished = true;
@@ -165,7 +497,38 @@ public:
 
 	void save_image()
 	{
-		img->write_image("final.ppm");
+		image_written = img->write_image(options.output);
+	}
+
+	// One line of JSON describing the finished job, printed in headless mode
+	// and written to the summary file if one was asked for
+	void write_summary(int status)
+	{
+		std::ostringstream out;
+		out << "{\"status\": " << status
+			<< ", \"scene\": " << json_quote(options.scene)
+			<< ", \"output\": " << json_quote(image_written ? options.output : "")
+			<< ", \"width\": " << stats.width
+			<< ", \"height\": " << stats.height
+			<< ", \"samples_per_pixel\": " << stats.samples_per_pixel
+			<< ", \"samples_done\": " << stats.samples_done
+			<< ", \"average_samples\": " << json_number(stats.average_samples)
+			<< ", \"stopped_early\": " << (stats.stopped_early ? "true" : "false")
+			<< ", \"threads\": " << stats.threads
+			<< ", \"setup_seconds\": " << json_number(setup_seconds)
+			<< ", \"render_seconds\": " << json_number(stats.render_seconds)
+			<< ", \"rays_traced\": " << stats.rays_traced
+			<< ", \"rays_per_second\": " << json_number(stats.render_seconds > 0 ? stats.rays_traced / stats.render_seconds : 0)
+			<< "}";
+
+		if (options.headless)
+			*summary_out << out.str() << std::endl;
+		if (!options.summary.empty()) {
+			std::ofstream file(options.summary);
+			file << out.str() << '\n';
+			if (!file)
+				std::cerr << "ERROR: Could not write summary file '" << options.summary << "'.\n";
+		}
 	}
 
 	void generate_preview()
@@ -178,6 +541,12 @@ public:
 		img->print_progress();
 	}
 
+	// Ends the render at the next tile and saves what has been accumulated so far
+	void stop_rendering()
+	{
+		stop_requested = true;
+	}
+
 	// Separate rendering thread to capture input in main
 	void start_rendering()
 	{
@@ -193,21 +562,85 @@ public:
 private:
 	std::thread render_thread;
 	image* img;
+	scene render_scene;
+	bool scene_loaded;
+	std::atomic<bool> stop_requested;
 
 public:
-	bool finished;
+	std::atomic<bool> finished;
+
+	render_options options;
+	std::ostream* summary_out = &std::cout;	// where headless runs print the summary
+
+	// Results of the last render, for the summary
+	struct render_stats {
+		int width = 0;
+		int height = 0;
+		int samples_per_pixel = 0;
+		int samples_done = 0;
+		double average_samples = 0;
+		bool stopped_early = false;
+		int threads = 0;
+		double render_seconds = 0;
+		unsigned long long rays_traced = 0;
+	} stats;
+	double setup_seconds = 0;
+	bool image_written = false;
 };
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (argc > 1 && std::string(argv[1]) == "--bench-aabb") {
+		run_aabb_benchmark(argc > 2 ? std::atoll(argv[2]) : 20000000);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-dispatch") {
+		run_dispatch_benchmark(argc > 2 ? std::max(1, std::atoi(argv[2])) : 200,
+			argc > 3 ? std::max(1, std::atoi(argv[3])) : 16);
+		return 0;
+	}
+
+	render_options options;
+	if (!parse_render_options(argc, argv, options)) {
+		print_usage(std::cerr);
+		return exit_usage_error;
+	}
+	if (options.help) {
+		print_usage(std::cout);
+		return exit_ok;
+	}
+	scene_cache_enabled() = options.use_cache;
+
+	// Headless runs keep stdout for the JSON summary alone; everything else
+	// written to std::cout goes to stderr
+	std::ostream summary_out(std::cout.rdbuf());
+	if (options.headless)
+		std::cout.rdbuf(std::cerr.rdbuf());
+
 	auto start = std::chrono::high_resolution_clock::now();
 
-	renderer rend = renderer();
+	renderer rend;
+	rend.options = options;
+	rend.summary_out = &summary_out;
+	if (!options.scene.empty() && !rend.load_scene(options.scene)) {
+		rend.write_summary(exit_scene_error);
+		return exit_scene_error;
+	}
+
+	// Batch mode: render on this thread without reading any input
+	if (options.headless) {
+		rend.render();
+		int status = rend.image_written ? exit_ok : exit_output_error;
+		rend.write_summary(status);
+		return status;
+	}
+
 	rend.start_rendering();
 
 	std::cout << "/// enter p to generate a preview" << std::endl;
 	std::cout << "/// enter s to display rendering status" << std::endl;
 	std::cout << "/// enter t to estimate the remaining time" << std::endl;
+	std::cout << "/// enter q to stop early and save the current frame" << std::endl;
 
 	// Capture input until rendering is done
 	std::string inp;
@@ -225,6 +658,10 @@ int main()
 		{
 			rend.display_status();
 		}
+		else if (inp.find("q") != std::string::npos)
+		{
+			rend.stop_rendering();
+		}
 		else if (inp.find("t") != std::string::npos)
 		{
 			// Estimate time remaining
@@ -242,6 +679,9 @@ int main()
 	auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
 	std::cout << "\nTook " << (double)duration.count() << " seconds to finish\n" << std::endl;
 
+	int status = rend.image_written ? exit_ok : exit_output_error;
+	rend.write_summary(status);
+
 	system("pause");
-	return 0;
+	return status;
 }
\ No newline at end of file
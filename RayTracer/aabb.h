@@ -11,19 +11,19 @@ public:
 	point3 min() const { return minimum; }
 	point3 max() const { return maximum; }
 
-	bool hit(const ray& r, double t_min, double t_max) const {
-		for (int a = 0; a < 3; a++)
-		{
-			auto t0 = fmin((minimum[a] - r.origin()[a]) / r.direction()[a],
-				(maximum[a] - r.origin()[a]) / r.direction()[a]);
-			auto t1 = fmax((minimum[a] - r.origin()[a]) / r.direction()[a],
-				(maximum[a] - r.origin()[a]) / r.direction()[a]);
-			t_min = fmax(t0, t_min);
-			t_max = fmin(t1, t_max);
-			if (t_max <= t_min)
-				return false;
+	// Slab test. The signs of the direction pick the near and far plane per
+	// axis, so no min/max of the two distances is needed. A ray lying in a slab
+	// plane computes 0 * inf = NaN; the comparisons are written so that a NaN
+	// leaves the interval unchanged, which keeps such rays from being culled.
+	// The selects compile to branch-free min/max instructions.
+	bool hit(const ray& r, real t_min, real t_max) const {
+		for (int a = 0; a < 3; a++) {
+			auto t0 = ((r.sign[a] ? maximum[a] : minimum[a]) - r.orig[a]) * r.inv_dir[a];
+			auto t1 = ((r.sign[a] ? minimum[a] : maximum[a]) - r.orig[a]) * r.inv_dir[a];
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
 		}
-		return true;
+		return t_min < t_max;
 	}
 
 	point3 minimum;
@@ -42,19 +42,4 @@ aabb surrounding_box(aabb box0, aabb box1) {
 	return aabb(small, big);
 }
 
-//inline bool aabb::hit(const ray& r, double t_min, double t_max) const {
-//	for (int a = 0; a < 3; a++) {
-//		auto invD = 1.0f / r.direction()[a];
-//		auto t0 = (min()[a] - r.origin()[a]) * invD;
-//		auto t1 = (max()[a] - r.origin()[a]) * invD;
-//		if (invD < 0.0f)
-//			std::swap(t0, t1);
-//		t_min = t0 > t_min ? t0 : t_min;
-//		t_max = t1 < t_max ? t1 : t_max;
-//		if (t_max <= t_min)
-//			return false;
-//	}
-//	return true;
-//}
-
 #endif // !AABB_H
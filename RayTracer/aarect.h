@@ -4,6 +4,7 @@
 #include "rtcommon.h"
 
 #include "hittable.h"
+#include "hittable_list.h"
 
 class xy_rect : public hittable {
 public:
@@ -13,7 +14,12 @@ public:
         shared_ptr<material> mat)
         : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+    virtual void surface(const ray& r, hit_record& rec) const override;
+
+    virtual hittable_kind kind() const override {
+        return hittable_kind::xy_rect;
+    }
 
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -22,9 +28,17 @@ public:
         return true;
     }
 
+    virtual double pdf_value(const point3& origin, const vec3& v) const override;
+    virtual vec3 random(const point3& origin) const override;
+
+    virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+        if (mp->is_emissive())
+            lights.add(self);
+    }
+
 public:
     shared_ptr<material> mp;
-    double x0, x1, y0, y1, k;
+    real x0, x1, y0, y1, k;
 };
 
 class xz_rect : public hittable {
@@ -35,7 +49,12 @@ public:
         shared_ptr<material> mat)
         : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+    virtual void surface(const ray& r, hit_record& rec) const override;
+
+    virtual hittable_kind kind() const override {
+        return hittable_kind::xz_rect;
+    }
 
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -44,9 +63,17 @@ public:
         return true;
     }
 
+    virtual double pdf_value(const point3& origin, const vec3& v) const override;
+    virtual vec3 random(const point3& origin) const override;
+
+    virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+        if (mp->is_emissive())
+            lights.add(self);
+    }
+
 public:
     shared_ptr<material> mp;
-    double x0, x1, z0, z1, k;
+    real x0, x1, z0, z1, k;
 };
 
 class yz_rect : public hittable {
@@ -57,7 +84,12 @@ public:
         shared_ptr<material> mat)
         : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+    virtual void surface(const ray& r, hit_record& rec) const override;
+
+    virtual hittable_kind kind() const override {
+        return hittable_kind::yz_rect;
+    }
 
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the X
@@ -66,12 +98,20 @@ public:
         return true;
     }
 
+    virtual double pdf_value(const point3& origin, const vec3& v) const override;
+    virtual vec3 random(const point3& origin) const override;
+
+    virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+        if (mp->is_emissive())
+            lights.add(self);
+    }
+
 public:
     shared_ptr<material> mp;
-    double y0, y1, z0, z1, k;
+    real y0, y1, z0, z1, k;
 };
 
-bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool xy_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     auto t = (k - r.origin().z()) / r.direction().z();
     if (t < t_min || t > t_max)
         return false;
@@ -79,17 +119,27 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     auto y = r.origin().y() + t * r.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
+    rec.pending = this;
+    return true;
+}
+
+void xy_rect::surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    if (!rec.mat_ptr)
+        rec.mat_ptr = mp.get();
+    if (rec.mat_ptr->uses_uv()) {
+        rec.u = (rec.p.x() - x0) / (x1 - x0);
+        rec.v = (rec.p.y() - y0) / (y1 - y0);
+    }
+    else {
+        rec.u = rec.v = 0;
+    }
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
 }
 
-bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool xz_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     auto t = (k - r.origin().y()) / r.direction().y();
     if (t < t_min || t > t_max)
         return false;
@@ -97,17 +147,27 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     auto z = r.origin().z() + t * r.direction().z();
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.pending = this;
+    return true;
+}
+
+void xz_rect::surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    if (!rec.mat_ptr)
+        rec.mat_ptr = mp.get();
+    if (rec.mat_ptr->uses_uv()) {
+        rec.u = (rec.p.x() - x0) / (x1 - x0);
+        rec.v = (rec.p.z() - z0) / (z1 - z0);
+    }
+    else {
+        rec.u = rec.v = 0;
+    }
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
 }
 
-bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool yz_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     auto t = (k - r.origin().x()) / r.direction().x();
     if (t < t_min || t > t_max)
         return false;
@@ -115,14 +175,81 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     auto z = r.origin().z() + t * r.direction().z();
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.pending = this;
+    return true;
+}
+
+void yz_rect::surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    if (!rec.mat_ptr)
+        rec.mat_ptr = mp.get();
+    if (rec.mat_ptr->uses_uv()) {
+        rec.u = (rec.p.y() - y0) / (y1 - y0);
+        rec.v = (rec.p.z() - z0) / (z1 - z0);
+    }
+    else {
+        rec.u = rec.v = 0;
+    }
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+}
+
+// Area light sampling: a point is picked uniformly on the rectangle, so the
+// solid angle density is distance^2 / (cosine * area)
+double xy_rect::pdf_value(const point3& origin, const vec3& v) const {
+    hit_record rec;
+    if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+        return 0;
+
+    auto area = (x1 - x0) * (y1 - y0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.z() / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+vec3 xy_rect::random(const point3& origin) const {
+    auto random_point = point3(random_double(x0, x1), random_double(y0, y1), k);
+    return random_point - origin;
+}
+
+// Area light sampling: a point is picked uniformly on the rectangle, so the
+// solid angle density is distance^2 / (cosine * area)
+double xz_rect::pdf_value(const point3& origin, const vec3& v) const {
+    hit_record rec;
+    if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+        return 0;
+
+    auto area = (x1 - x0) * (z1 - z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.y() / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+vec3 xz_rect::random(const point3& origin) const {
+    auto random_point = point3(random_double(x0, x1), k, random_double(z0, z1));
+    return random_point - origin;
+}
+
+// Area light sampling: a point is picked uniformly on the rectangle, so the
+// solid angle density is distance^2 / (cosine * area)
+double yz_rect::pdf_value(const point3& origin, const vec3& v) const {
+    hit_record rec;
+    if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+        return 0;
+
+    auto area = (y1 - y0) * (z1 - z0);
+    auto distance_squared = rec.t * rec.t * v.length_squared();
+    auto cosine = fabs(v.x() / v.length());
+
+    return distance_squared / (cosine * area);
+}
+
+vec3 yz_rect::random(const point3& origin) const {
+    auto random_point = point3(k, random_double(y0, y1), random_double(z0, z1));
+    return random_point - origin;
 }
 
 #endif // !AARECT_H
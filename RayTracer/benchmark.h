@@ -0,0 +1,83 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "aabb.h"
+
+// The slab test aabb::hit used before rays carried their reciprocal direction:
+// two divisions per axis plus fmin/fmax. Kept as the baseline for the benchmark.
+inline bool aabb_hit_divide(const aabb& box, const ray& r, double t_min, double t_max) {
+	for (int a = 0; a < 3; a++) {
+		auto t0 = fmin((box.minimum[a] - r.origin()[a]) / r.direction()[a],
+			(box.maximum[a] - r.origin()[a]) / r.direction()[a]);
+		auto t1 = fmax((box.minimum[a] - r.origin()[a]) / r.direction()[a],
+			(box.maximum[a] - r.origin()[a]) / r.direction()[a]);
+		t_min = fmax(t0, t_min);
+		t_max = fmin(t1, t_max);
+		if (t_max <= t_min)
+			return false;
+	}
+	return true;
+}
+
+// Times both slab tests on the same random ray/box pairs and checks that they
+// agree. Every ray is tested against every box; both sets are small enough to
+// stay in cache, so the timings measure the tests and not memory.
+// Run with --bench-aabb [pairs].
+inline void run_aabb_benchmark(long long pairs) {
+	const int ray_count = 1024;
+	const int box_count = static_cast<int>(std::max(1LL, pairs / ray_count));
+	pairs = static_cast<long long>(ray_count) * box_count;
+
+	std::vector<ray> rays;
+	std::vector<aabb> boxes;
+
+	for (int i = 0; i < ray_count; i++) {
+		// Rays from around the boxes towards them, so that a fair share hits
+		point3 origin = vec3::random(-3, 3);
+		vec3 direction = vec3::random(-1, 1) - origin;
+		// Some axis-aligned rays, which hit the 0 * inf case on the slab planes
+		if (i % 16 == 0)
+			direction = vec3(0, 0, direction.z() < 0 ? -1 : 1);
+		rays.emplace_back(origin, direction);
+	}
+
+	for (int i = 0; i < box_count; i++) {
+		point3 a = vec3::random(-1, 1);
+		boxes.emplace_back(a, a + vec3::random(0.1, 0.5));
+	}
+
+	auto time_test = [&](const char* name, auto test) {
+		auto start = std::chrono::high_resolution_clock::now();
+		long long hits = 0;
+		for (const auto& box : boxes)
+			for (const auto& r : rays)
+				hits += test(box, r) ? 1 : 0;
+		auto stop = std::chrono::high_resolution_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+		std::cout << name << ": " << ns / pairs << " ns per test, " << hits << " hits\n";
+		return hits;
+	};
+
+	auto divide_hits = time_test("divide + fmin/fmax", [](const aabb& box, const ray& r) {
+		return aabb_hit_divide(box, r, 0.001, infinity);
+	});
+	auto slab_hits = time_test("inverse direction ", [](const aabb& box, const ray& r) {
+		return box.hit(r, 0.001, infinity);
+	});
+
+	long long mismatches = 0;
+	for (const auto& box : boxes)
+		for (const auto& r : rays)
+			mismatches += aabb_hit_divide(box, r, 0.001, infinity) != box.hit(r, 0.001, infinity) ? 1 : 0;
+	std::cout << pairs << " ray/box pairs, " << mismatches << " results differ"
+		<< (divide_hits == slab_hits ? "" : " (hit counts differ)") << "\n";
+}
+
+#endif // !BENCHMARK_H
@@ -3,43 +3,151 @@
 
 #include "rtcommon.h"
 
-#include "aarect.h"
+#include "hittable.h"
 #include "hittable_list.h"
 
+// Axis aligned box, intersected with one slab test. The face that was hit is
+// the slab the ray enters last, or leaves first when it starts inside; each
+// face has the normal and the u, v mapping of the rectangle it replaces.
 class box : public hittable {
 public:
 	box() {}
-	box(const point3& p0, const point3& p1, shared_ptr<material> ptr);
+	box(const point3& p0, const point3& p1, shared_ptr<material> ptr)
+		: box_min(p0), box_max(p1), mp(ptr) {}
 
-	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual void surface(const ray& r, hit_record& rec) const override;
+
+	virtual hittable_kind kind() const override {
+		return hittable_kind::box;
+	}
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
 		output_box = aabb(box_min, box_max);
 		return true;
 	}
 
+	virtual double pdf_value(const point3& origin, const vec3& v) const override;
+	virtual vec3 random(const point3& origin) const override;
+
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+		if (mp->is_emissive())
+			lights.add(self);
+	}
+
 public:
 	point3 box_min;
 	point3 box_max;
-	hittable_list sides;
+	shared_ptr<material> mp;
+
+private:
+	// Distances to the planes where r enters and leaves the box, and their axes.
+	// Slabs that compute NaN, for rays lying in one of their planes, are skipped.
+	bool slab(const ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const;
 };
 
-box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr) {
-	box_min = p0;
-	box_max = p1;
+inline bool box::slab(const ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const {
+	t_near = -infinity;
+	t_far = infinity;
+	near_axis = far_axis = 0;
+	for (int a = 0; a < 3; a++) {
+		auto t0 = ((r.sign[a] ? box_max[a] : box_min[a]) - r.orig[a]) * r.inv_dir[a];
+		auto t1 = ((r.sign[a] ? box_min[a] : box_max[a]) - r.orig[a]) * r.inv_dir[a];
+		if (t0 > t_near) {
+			t_near = t0;
+			near_axis = a;
+		}
+		if (t1 < t_far) {
+			t_far = t1;
+			far_axis = a;
+		}
+	}
+	return t_near <= t_far;
+}
+
+bool box::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	real t_near, t_far;
+	int near_axis, far_axis;
+	if (!slab(r, t_near, t_far, near_axis, far_axis))
+		return false;
+
+	real t;
+	if (t_near >= t_min && t_near <= t_max)
+		t = t_near;
+	else if (t_far >= t_min && t_far <= t_max)
+		t = t_far;
+	else
+		return false;
+
+	rec.t = t;
+	rec.pending = this;
+	return true;
+}
 
-	sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-	sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
+void box::surface(const ray& r, hit_record& rec) const {
+	// Redoing the slab test is cheaper than keeping the face in every hit,
+	// and leaves rec.primitive to compiled_scene
+	real t_near, t_far;
+	int near_axis, far_axis;
+	slab(r, t_near, t_far, near_axis, far_axis);
+	bool entering = fabs(rec.t - t_near) <= fabs(rec.t - t_far);
+	int axis = entering ? near_axis : far_axis;
+	// The near plane of an axis is its max side for rays going down that axis
+	bool max_side = entering == (r.sign[axis] != 0);
 
-	sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-	sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
+	rec.p = r.at(rec.t);
+	if (!rec.mat_ptr)
+		rec.mat_ptr = mp.get();
+	if (rec.mat_ptr->uses_uv()) {
+		int u_axis = axis == 0 ? 1 : 0;
+		int v_axis = axis == 2 ? 1 : 2;
+		rec.u = (rec.p[u_axis] - box_min[u_axis]) / (box_max[u_axis] - box_min[u_axis]);
+		rec.v = (rec.p[v_axis] - box_min[v_axis]) / (box_max[v_axis] - box_min[v_axis]);
+	}
+	else {
+		rec.u = rec.v = 0;
+	}
+	vec3 outward_normal(0, 0, 0);
+	outward_normal[axis] = max_side ? 1 : -1;
+	rec.set_face_normal(r, outward_normal);
+}
 
-	sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-	sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
+// Light sampling picks one of the six faces uniformly and a point uniformly
+// on it, so the density of a direction is the mean of the densities of the
+// faces it crosses, each distance^2 / (cosine * area)
+double box::pdf_value(const point3& origin, const vec3& v) const {
+	auto length = v.length();
+	auto sum = 0.0;
+	for (int a = 0; a < 3; a++) {
+		if (v[a] == 0)
+			continue;
+		int u_axis = a == 0 ? 1 : 0;
+		int v_axis = a == 2 ? 1 : 2;
+		auto area = (box_max[u_axis] - box_min[u_axis]) * (box_max[v_axis] - box_min[v_axis]);
+		auto cosine = fabs(v[a] / length);
+		for (real k : { box_min[a], box_max[a] }) {
+			auto t = (k - origin[a]) / v[a];
+			if (t < 0.001)
+				continue;
+			auto p = origin + t * v;
+			if (p[u_axis] < box_min[u_axis] || p[u_axis] > box_max[u_axis]
+				|| p[v_axis] < box_min[v_axis] || p[v_axis] > box_max[v_axis])
+				continue;
+			sum += t * t * v.length_squared() / (cosine * area);
+		}
+	}
+	return sum / 6;
 }
 
-bool box::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	return sides.hit(r, t_min, t_max, rec);
+vec3 box::random(const point3& origin) const {
+	int face = random_int(0, 5);
+	int a = face / 2;
+	point3 random_point(
+		random_double(box_min.x(), box_max.x()),
+		random_double(box_min.y(), box_max.y()),
+		random_double(box_min.z(), box_max.z()));
+	random_point[a] = face % 2 ? box_max[a] : box_min[a];
+	return random_point - origin;
 }
 
 #endif // !BOX_H
@@ -7,32 +7,47 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "scene_arena.h"
 
 
 class bvh_node : public hittable {
 public:
 	bvh_node();
 
-	bvh_node(const hittable_list& list, double time0, double time1)
-		: bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+	// Inner nodes go into arena when one is given, otherwise onto the heap
+	bvh_node(const hittable_list& list, double time0, double time1, scene_arena* arena = nullptr)
+		: bvh_node(list.objects, time0, time1, arena)
 	{}
 
+	// Takes one modifiable copy of the objects for the whole tree
+	bvh_node(std::vector<shared_ptr<hittable>> objects, double time0, double time1, scene_arena* arena = nullptr)
+		: bvh_node(objects, 0, objects.size(), time0, time1, arena)
+	{}
+
+	// Sorts objects in place, children share the array instead of copying it
 	bvh_node(
-		const std::vector<shared_ptr<hittable>>& src_objects,
-		size_t start, size_t end, double time0, double time1);
+		std::vector<shared_ptr<hittable>>& objects,
+		size_t start, size_t end, double time0, double time1,
+		scene_arena* arena = nullptr);
 
 	virtual bool hit(
-		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+	virtual void collect_primitives(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& out) const override {
+		left->collect_primitives(left, out);
+		if (right != left)
+			right->collect_primitives(right, out);
+	}
+
 public:
 	shared_ptr<hittable> left;
 	shared_ptr<hittable> right;
 	aabb box;
 };
 
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
+inline bool box_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b, int axis) {
 	aabb box_a;
 	aabb box_b;
 
@@ -42,24 +57,23 @@ inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable>
 	return box_a.min().e[axis] < box_b.min().e[axis];
 }
 
-bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+bool box_x_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
 	return box_compare(a, b, 0);
 }
 
-bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+bool box_y_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
 	return box_compare(a, b, 1);
 }
 
-bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+bool box_z_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
 	return box_compare(a, b, 2);
 }
 
 bvh_node::bvh_node(
-    const std::vector<shared_ptr<hittable>>& src_objects,
-    size_t start, size_t end, double time0, double time1
+    std::vector<shared_ptr<hittable>>& objects,
+    size_t start, size_t end, double time0, double time1,
+    scene_arena* arena
 ) {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
-
     int axis = random_int(0, 2);
     auto comparator = (axis == 0) ? box_x_compare
         : (axis == 1) ? box_y_compare
@@ -84,8 +98,14 @@ bvh_node::bvh_node(
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
         auto mid = start + object_span / 2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        if (arena) {
+            left = arena->make<bvh_node>(objects, start, mid, time0, time1, arena);
+            right = arena->make<bvh_node>(objects, mid, end, time0, time1, arena);
+        }
+        else {
+            left = make_shared<bvh_node>(objects, start, mid, time0, time1);
+            right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        }
     }
 
     aabb box_left, box_right;
@@ -99,7 +119,7 @@ bvh_node::bvh_node(
 }
 
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	if (!box.hit(r, t_min, t_max))
 		return false;
 
@@ -11,6 +11,10 @@
 //		<< static_cast<int>(255.999 * pixel_color.z()) << '\n';
 //}
 
+inline double luminance(const color& c) {
+	return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
 	auto r = pixel_color.x();
 	auto g = pixel_color.y();
@@ -0,0 +1,370 @@
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+
+#include <chrono>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+#include "texture.h"
+#include "wide_bvh.h"
+
+struct compiled_primitive {
+	hittable_kind kind;
+	int material;			// index into materials, -1 for kind other
+	const hittable* object;
+};
+
+struct compiled_material {
+	material_kind kind;
+	int texture;			// albedo or emission, -1 if the material has none
+	const material* source;
+};
+
+struct compiled_texture {
+	texture_kind kind;
+	color solid;			// value of a solid color
+	int even, odd;			// textures of a checker
+	const texture* source;
+};
+
+struct compiled_scene_stats {
+	int primitives = 0;
+	int virtual_primitives = 0;
+	int materials = 0;
+	int virtual_materials = 0;
+	int textures = 0;
+	int virtual_textures = 0;
+	double build_ms = 0;
+};
+
+inline std::ostream& operator << (std::ostream& out, const compiled_scene_stats& stats) {
+	return out << stats.primitives << " primitives (" << stats.virtual_primitives << " virtual), "
+		<< stats.materials << " materials (" << stats.virtual_materials << " virtual), "
+		<< stats.textures << " textures (" << stats.virtual_textures << " virtual), "
+		<< "compiled in " << stats.build_ms << " ms";
+}
+
+// The world flattened into one wide BVH over its primitives, with the
+// primitives, materials and textures stored as tags plus the object they came
+// from. Intersection and shading switch over the tags and call the concrete
+// type's functions by their qualified names, so the compiler sees the callee
+// and can inline it where a virtual call would be one indirect jump per
+// primitive, scatter, emitted and texture lookup. Types outside the closed set
+// (meshes, sphere sets, instances, transforms, media) keep their virtual
+// calls, and so do the materials of hits inside them. Only the final closest
+// hit of a ray pays for one virtual uses_uv() while its surface is built.
+//
+// Holds raw pointers into the world, which has to outlive it. Passed to the
+// integrators in place of a virtual_world.
+class compiled_scene {
+public:
+	compiled_scene(const hittable_list& world, double time0, double time1,
+		const bvh_build_options& options = default_bvh_options());
+
+	bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+
+	void finish(const ray& r, hit_record& rec) const;
+
+	color emitted(const hit_record& rec) const;
+
+	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const;
+
+	double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const;
+
+	color texture_value(int index, double u, double v, const point3& p) const;
+
+public:
+	std::vector<wide_bvh_node> nodes;
+	std::vector<compiled_primitive> primitives;	// in leaf order
+	std::vector<compiled_material> materials;
+	std::vector<compiled_texture> textures;
+	compiled_scene_stats stats;
+
+	static const size_t small_scene_size = 4;
+
+private:
+	bool primitive_hit(const compiled_primitive& p, const ray& r, real t_min, real t_max, hit_record& rec) const;
+
+	int add_material(const material* m);
+	int add_texture(const texture* t);
+
+	std::vector<shared_ptr<hittable>> objects;
+	std::unordered_map<const material*, int> material_lookup;
+	std::unordered_map<const texture*, int> texture_lookup;
+};
+
+compiled_scene::compiled_scene(const hittable_list& world, double time0, double time1,
+	const bvh_build_options& options) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (const auto& object : world.objects)
+		object->collect_primitives(object, objects);
+
+	std::vector<aabb> boxes(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		if (!objects[i]->bounding_box(time0, time1, boxes[i]))
+			std::cerr << "No bounding box in compiled_scene constructor.\n";
+	}
+
+	bvh_builder builder(boxes, options);
+	if (!builder.nodes.empty())
+		collapse_bvh(builder.nodes, 0, nodes);
+
+	primitives.reserve(objects.size());
+	for (int index : builder.prim_indices) {
+		const hittable* object = objects[index].get();
+		compiled_primitive p = { object->kind(), -1, object };
+		switch (p.kind) {
+		case hittable_kind::sphere:
+			p.material = add_material(static_cast<const sphere*>(object)->mat_ptr.get());
+			break;
+		case hittable_kind::moving_sphere:
+			p.material = add_material(static_cast<const moving_sphere*>(object)->mat_ptr.get());
+			break;
+		case hittable_kind::xy_rect:
+			p.material = add_material(static_cast<const xy_rect*>(object)->mp.get());
+			break;
+		case hittable_kind::xz_rect:
+			p.material = add_material(static_cast<const xz_rect*>(object)->mp.get());
+			break;
+		case hittable_kind::yz_rect:
+			p.material = add_material(static_cast<const yz_rect*>(object)->mp.get());
+			break;
+		case hittable_kind::box:
+			p.material = add_material(static_cast<const box*>(object)->mp.get());
+			break;
+		default:
+			stats.virtual_primitives++;
+			break;
+		}
+		primitives.push_back(p);
+	}
+
+	auto stop = std::chrono::high_resolution_clock::now();
+	stats.primitives = static_cast<int>(primitives.size());
+	stats.materials = static_cast<int>(materials.size());
+	stats.textures = static_cast<int>(textures.size());
+	stats.build_ms = std::chrono::duration<double, std::milli>(stop - start).count();
+
+	if (options.report_stats)
+		std::cout << "compiled_scene: " << stats << ", " << wide_stats(nodes) << "\n";
+}
+
+int compiled_scene::add_material(const material* m) {
+	auto found = material_lookup.find(m);
+	if (found != material_lookup.end())
+		return found->second;
+
+	compiled_material c = { m->kind(), -1, m };
+	switch (c.kind) {
+	case material_kind::lambertian:
+		c.texture = add_texture(static_cast<const lambertian*>(m)->albedo.get());
+		break;
+	case material_kind::diffuse_light:
+		c.texture = add_texture(static_cast<const diffuse_light*>(m)->emit.get());
+		break;
+	case material_kind::isotropic:
+		c.texture = add_texture(static_cast<const isotropic*>(m)->albedo.get());
+		break;
+	case material_kind::other:
+		stats.virtual_materials++;
+		break;
+	default:
+		break;
+	}
+
+	int index = static_cast<int>(materials.size());
+	material_lookup[m] = index;
+	materials.push_back(c);
+	return index;
+}
+
+int compiled_scene::add_texture(const texture* t) {
+	auto found = texture_lookup.find(t);
+	if (found != texture_lookup.end())
+		return found->second;
+
+	compiled_texture c = { t->kind(), color(0, 0, 0), -1, -1, t };
+	switch (c.kind) {
+	case texture_kind::solid_color:
+		c.solid = t->value(0, 0, point3(0, 0, 0));
+		break;
+	case texture_kind::checker:
+		c.even = add_texture(static_cast<const checker_texture*>(t)->even.get());
+		c.odd = add_texture(static_cast<const checker_texture*>(t)->odd.get());
+		break;
+	case texture_kind::other:
+		stats.virtual_textures++;
+		break;
+	default:
+		break;
+	}
+
+	int index = static_cast<int>(textures.size());
+	texture_lookup[t] = index;
+	textures.push_back(c);
+	return index;
+}
+
+inline bool compiled_scene::primitive_hit(
+	const compiled_primitive& p, const ray& r, real t_min, real t_max, hit_record& rec) const {
+	switch (p.kind) {
+	case hittable_kind::sphere:
+		return static_cast<const sphere*>(p.object)->sphere::hit(r, t_min, t_max, rec);
+	case hittable_kind::moving_sphere:
+		return static_cast<const moving_sphere*>(p.object)->moving_sphere::hit(r, t_min, t_max, rec);
+	case hittable_kind::xy_rect:
+		return static_cast<const xy_rect*>(p.object)->xy_rect::hit(r, t_min, t_max, rec);
+	case hittable_kind::xz_rect:
+		return static_cast<const xz_rect*>(p.object)->xz_rect::hit(r, t_min, t_max, rec);
+	case hittable_kind::yz_rect:
+		return static_cast<const yz_rect*>(p.object)->yz_rect::hit(r, t_min, t_max, rec);
+	case hittable_kind::box:
+		return static_cast<const box*>(p.object)->box::hit(r, t_min, t_max, rec);
+	default:
+		return p.object->hit(r, t_min, t_max, rec);
+	}
+}
+
+bool compiled_scene::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	auto leaf_hit = [&](int first, int count, real& closest) {
+		bool hit_leaf = false;
+		for (int i = first; i < first + count; i++) {
+			const compiled_primitive& p = primitives[i];
+			if (primitive_hit(p, r, t_min, closest, rec)) {
+				hit_leaf = true;
+				closest = rec.t;
+				rec.material_index = p.material;
+				// Objects of kind other may keep their own primitive index in rec
+				if (p.material >= 0)
+					rec.primitive = i;
+			}
+		}
+		return hit_leaf;
+	};
+
+	// A handful of primitives are tested faster one after the other than through a box test
+	if (primitives.size() <= small_scene_size)
+		return leaf_hit(0, static_cast<int>(primitives.size()), t_max);
+	return traverse_wide_bvh(nodes, r, t_min, t_max, leaf_hit);
+}
+
+// Builds the surface of a hit on a known primitive without a virtual surface()
+void compiled_scene::finish(const ray& r, hit_record& rec) const {
+	if (rec.material_index < 0 || !rec.pending) {
+		rec.finish(r);
+		return;
+	}
+
+	const compiled_primitive& p = primitives[rec.primitive];
+	rec.pending = nullptr;
+	rec.mat_ptr = nullptr;
+	switch (p.kind) {
+	case hittable_kind::sphere:
+		static_cast<const sphere*>(p.object)->sphere::surface(r, rec);
+		break;
+	case hittable_kind::moving_sphere:
+		static_cast<const moving_sphere*>(p.object)->moving_sphere::surface(r, rec);
+		break;
+	case hittable_kind::xy_rect:
+		static_cast<const xy_rect*>(p.object)->xy_rect::surface(r, rec);
+		break;
+	case hittable_kind::xz_rect:
+		static_cast<const xz_rect*>(p.object)->xz_rect::surface(r, rec);
+		break;
+	case hittable_kind::yz_rect:
+		static_cast<const yz_rect*>(p.object)->yz_rect::surface(r, rec);
+		break;
+	case hittable_kind::box:
+		static_cast<const box*>(p.object)->box::surface(r, rec);
+		break;
+	default:
+		p.object->surface(r, rec);
+		break;
+	}
+}
+
+color compiled_scene::texture_value(int index, double u, double v, const point3& p) const {
+	const compiled_texture& t = textures[index];
+	switch (t.kind) {
+	case texture_kind::solid_color:
+		return t.solid;
+	case texture_kind::checker:
+		return texture_value(checker_texture::is_odd(p) ? t.odd : t.even, u, v, p);
+	case texture_kind::noise:
+		return static_cast<const noise_texture*>(t.source)->noise_texture::value(u, v, p);
+	case texture_kind::image:
+		return static_cast<const image_texture*>(t.source)->image_texture::value(u, v, p);
+	default:
+		return t.source->value(u, v, p);
+	}
+}
+
+color compiled_scene::emitted(const hit_record& rec) const {
+	if (rec.material_index < 0)
+		return rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+	const compiled_material& m = materials[rec.material_index];
+	switch (m.kind) {
+	case material_kind::diffuse_light:
+		return texture_value(m.texture, rec.u, rec.v, rec.p);
+	case material_kind::other:
+		return m.source->emitted(rec.u, rec.v, rec.p);
+	default:
+		return color(0, 0, 0);
+	}
+}
+
+bool compiled_scene::scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+	if (rec.material_index < 0)
+		return rec.mat_ptr->scatter(r_in, rec, attenuation, scattered);
+
+	const compiled_material& m = materials[rec.material_index];
+	switch (m.kind) {
+	case material_kind::lambertian:
+		scattered = lambertian::sample(r_in, rec);
+		attenuation = texture_value(m.texture, rec.u, rec.v, rec.p);
+		return true;
+	case material_kind::metal:
+		return static_cast<const metal*>(m.source)->metal::scatter(r_in, rec, attenuation, scattered);
+	case material_kind::dielectric:
+		return static_cast<const dielectric*>(m.source)->dielectric::scatter(r_in, rec, attenuation, scattered);
+	case material_kind::diffuse_light:
+		return false;
+	case material_kind::isotropic:
+		scattered = isotropic::sample(r_in, rec);
+		attenuation = texture_value(m.texture, rec.u, rec.v, rec.p);
+		return true;
+	default:
+		return m.source->scatter(r_in, rec, attenuation, scattered);
+	}
+}
+
+double compiled_scene::scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+	if (rec.material_index < 0)
+		return rec.mat_ptr->scattering_pdf(r_in, rec, scattered);
+
+	const compiled_material& m = materials[rec.material_index];
+	switch (m.kind) {
+	case material_kind::lambertian:
+		return static_cast<const lambertian*>(m.source)->lambertian::scattering_pdf(r_in, rec, scattered);
+	case material_kind::isotropic:
+		return static_cast<const isotropic*>(m.source)->isotropic::scattering_pdf(r_in, rec, scattered);
+	case material_kind::other:
+		return m.source->scattering_pdf(r_in, rec, scattered);
+	default:
+		return 0;
+	}
+}
+
+#endif // !COMPILED_SCENE_H
@@ -22,7 +22,7 @@ public:
     {}
 
     virtual bool hit(
-        const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        const ray& r, real t_min, real t_max, hit_record& rec) const override;
 
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
         return boundary->bounding_box(time0, time1, output_box);
@@ -34,7 +34,7 @@ public:
     double neg_inv_density;
 };
 
-bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool constant_medium::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
@@ -44,7 +44,10 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
     if (!boundary->hit(r, -infinity, infinity, rec1))
         return false;
 
-    if (!boundary->hit(r, rec1.t + 0.0001, infinity, rec2))
+    // The gap to the exit point has to grow with t, or in float builds it
+    // rounds away on large boundaries and the entry point is found again
+    real gap = std::max<real>(0.0001, std::fabs(rec1.t) * 64 * std::numeric_limits<real>::epsilon());
+    if (!boundary->hit(r, rec1.t + gap, infinity, rec2))
         return false;
 
     if (debugging) std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
@@ -76,7 +79,8 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 
     rec.normal = vec3(1, 0, 0);  // arbitrary
     rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.mat_ptr = phase_function.get();
+    rec.pending = nullptr;  // the boundary hits only gave us t
 
     return true;
 }
@@ -0,0 +1,512 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+// Node of a linearized BVH. Nodes are laid out in depth-first order, so the
+// first child of an interior node is always the node right after it and only
+// the second child needs an explicit offset.
+struct linear_bvh_node {
+	aabb box;
+	int offset;		// leaf: index of the first primitive, interior: index of the second child
+	int prim_count;	// number of primitives in a leaf, 0 for interior nodes
+	int axis;		// split axis of an interior node
+};
+
+enum class bvh_split_method { median, sah };
+
+struct bvh_build_options {
+	bvh_split_method split_method = bvh_split_method::sah;
+
+	// Nodes with this many primitives or fewer always become leaves
+	int max_prims_in_leaf = 2;
+
+	// Nodes with more primitives than this are always split, even if SAH prefers a leaf
+	int max_sah_leaf_size = 8;
+
+	// Relative cost of one node traversal step and one primitive intersection
+	double traversal_cost = 0.5;
+	double intersection_cost = 1.0;
+
+	// Number of buckets per axis used to estimate SAH costs
+	int sah_bins = 16;
+
+	// Subtrees with at least this many primitives are built on their own thread
+	int parallel_build_cutoff = 4096;
+
+	// Print bvh_stats after every build
+	bool report_stats = true;
+};
+
+// Options used by accelerators built without explicit options, e.g. inside the scene classes
+inline bvh_build_options& default_bvh_options() {
+	static bvh_build_options options;
+	return options;
+}
+
+struct bvh_stats {
+	int node_count = 0;
+	int leaf_count = 0;
+	int max_depth = 0;
+	int prim_count = 0;
+	double avg_leaf_size = 0;
+	double sah_cost = 0;	// expected cost of a random ray hitting the root box
+	double build_ms = 0;
+};
+
+inline std::ostream& operator << (std::ostream& out, const bvh_stats& stats) {
+	return out << stats.prim_count << " prims, "
+		<< stats.node_count << " nodes, "
+		<< stats.leaf_count << " leaves, depth " << stats.max_depth
+		<< ", avg leaf size " << stats.avg_leaf_size
+		<< ", SAH cost " << stats.sah_cost
+		<< ", built in " << stats.build_ms << " ms";
+}
+
+inline double surface_area(const aabb& box) {
+	vec3 d = box.max() - box.min();
+	return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+// Builds a linear BVH over a set of bounding boxes. The result only refers to
+// primitives by index, so any primitive container can sit on top of it.
+class bvh_builder {
+public:
+	bvh_builder(const std::vector<aabb>& boxes, const bvh_build_options& build_options = default_bvh_options())
+		: options(build_options)
+	{
+		if (boxes.empty())
+			return;
+
+		prim_info.reserve(boxes.size());
+		for (const auto& b : boxes)
+			prim_info.push_back({ b, 0.5 * (b.min() + b.max()) });
+
+		prim_indices.resize(boxes.size());
+		for (size_t i = 0; i < boxes.size(); i++)
+			prim_indices[i] = static_cast<int>(i);
+
+		// Only fork while there are idle cores left to pick up the subtrees
+		unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+		while ((1u << max_fork_level) < cores)
+			max_fork_level++;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		nodes.reserve(2 * boxes.size());
+		build(0, static_cast<int>(boxes.size()), 0, nodes);
+
+		auto stop = std::chrono::high_resolution_clock::now();
+		build_ms = std::chrono::duration<double, std::milli>(stop - start).count();
+	}
+
+	bvh_stats stats() const {
+		bvh_stats result;
+		if (nodes.empty())
+			return result;
+
+		result.node_count = static_cast<int>(nodes.size());
+		result.prim_count = static_cast<int>(prim_indices.size());
+		result.max_depth = depth(0);
+
+		double inv_root_area = 1 / surface_area(nodes[0].box);
+		for (const auto& node : nodes) {
+			double relative_area = surface_area(node.box) * inv_root_area;
+			if (node.prim_count > 0) {
+				result.leaf_count++;
+				result.sah_cost += relative_area * options.intersection_cost * node.prim_count;
+			}
+			else {
+				result.sah_cost += relative_area * options.traversal_cost;
+			}
+		}
+		result.avg_leaf_size = (double)result.prim_count / result.leaf_count;
+		result.build_ms = build_ms;
+
+		return result;
+	}
+
+public:
+	// Depth-first ordered nodes, the root is nodes[0]
+	std::vector<linear_bvh_node> nodes;
+
+	// Leaves refer to ranges of this array, which holds indices into the input boxes
+	std::vector<int> prim_indices;
+
+	// Deeper trees would overflow the traversal stacks
+	static const int max_tree_depth = 63;
+
+private:
+	struct primitive_info {
+		aabb box;
+		point3 centroid;
+	};
+
+	// Builds the subtree over prim_indices[start, end) in place and appends its
+	// nodes to out. Child offsets are relative to the start of out, so subtrees
+	// built on other threads are shifted when they get spliced in.
+	int build(int start, int end, int level, std::vector<linear_bvh_node>& out) {
+		int node_index = static_cast<int>(out.size());
+		out.push_back(linear_bvh_node());
+
+		aabb bounds = prim_info[prim_indices[start]].box;
+		aabb centroid_bounds(prim_info[prim_indices[start]].centroid, prim_info[prim_indices[start]].centroid);
+		for (int i = start + 1; i < end; i++) {
+			const auto& info = prim_info[prim_indices[i]];
+			bounds = surrounding_box(bounds, info.box);
+			centroid_bounds = surrounding_box(centroid_bounds, aabb(info.centroid, info.centroid));
+		}
+
+		// Split along the axis with the largest spread of centroids
+		vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+		int axis = 0;
+		if (extent.y() > extent.x()) axis = 1;
+		if (extent.z() > extent[axis]) axis = 2;
+
+		int count = end - start;
+		if (count <= options.max_prims_in_leaf || extent[axis] <= 0 || level >= max_tree_depth) {
+			out[node_index] = { bounds, start, count, axis };
+			return node_index;
+		}
+
+		int mid = (options.split_method == bvh_split_method::sah)
+			? partition_sah(start, end, bounds, centroid_bounds, axis)
+			: partition_median(start, end, axis);
+
+		if (mid < 0) {
+			out[node_index] = { bounds, start, count, axis };
+			return node_index;
+		}
+
+		int second_child;
+		if (count >= options.parallel_build_cutoff && level < max_fork_level) {
+			// Both halves partition disjoint ranges of prim_indices, so they can be
+			// built concurrently into their own arrays and appended afterwards.
+			std::vector<linear_bvh_node> left_nodes;
+			auto left = std::async(std::launch::async,
+				[this, start, mid, level, &left_nodes] { build(start, mid, level + 1, left_nodes); });
+
+			std::vector<linear_bvh_node> right_nodes;
+			build(mid, end, level + 1, right_nodes);
+			left.get();
+
+			append_subtree(out, left_nodes);
+			second_child = static_cast<int>(out.size());
+			append_subtree(out, right_nodes);
+		}
+		else {
+			build(start, mid, level + 1, out);
+			second_child = build(mid, end, level + 1, out);
+		}
+		out[node_index] = { bounds, second_child, 0, axis };
+
+		return node_index;
+	}
+
+	static void append_subtree(std::vector<linear_bvh_node>& out, const std::vector<linear_bvh_node>& subtree) {
+		int base = static_cast<int>(out.size());
+		for (auto node : subtree) {
+			// Leaves index primitives, which are shared, only child offsets move
+			if (node.prim_count == 0)
+				node.offset += base;
+			out.push_back(node);
+		}
+	}
+
+	int partition_median(int start, int end, int axis) {
+		int mid = start + (end - start) / 2;
+		std::nth_element(
+			prim_indices.begin() + start, prim_indices.begin() + mid, prim_indices.begin() + end,
+			[this, axis](int a, int b) { return prim_info[a].centroid[axis] < prim_info[b].centroid[axis]; });
+		return mid;
+	}
+
+	// Picks the cheapest bucket boundary over all three axes and partitions the
+	// range around it. Returns -1 if a leaf is cheaper than any split. Updates
+	// axis to the chosen split axis.
+	int partition_sah(int start, int end, const aabb& bounds, const aabb& centroid_bounds, int& axis) {
+		struct bucket {
+			int count = 0;
+			aabb box;
+		};
+
+		const int bin_count = options.sah_bins;
+		std::vector<bucket> buckets(bin_count);
+		std::vector<double> costs(bin_count - 1);
+
+		double best_cost = infinity;
+		int best_axis = -1;
+		int best_split = 0;
+
+		for (int a = 0; a < 3; a++) {
+			double axis_min = centroid_bounds.min()[a];
+			double axis_extent = centroid_bounds.max()[a] - axis_min;
+			if (axis_extent <= 0)
+				continue;
+
+			for (auto& b : buckets)
+				b.count = 0;
+
+			for (int i = start; i < end; i++) {
+				const auto& info = prim_info[prim_indices[i]];
+				int b = bucket_index(info.centroid[a], axis_min, axis_extent);
+				buckets[b].box = buckets[b].count == 0 ? info.box : surrounding_box(buckets[b].box, info.box);
+				buckets[b].count++;
+			}
+
+			// Sweep from the left and the right to get both halves of each candidate split
+			aabb left_box;
+			int left_count = 0;
+			for (int i = 0; i < bin_count - 1; i++) {
+				if (buckets[i].count > 0) {
+					left_box = left_count == 0 ? buckets[i].box : surrounding_box(left_box, buckets[i].box);
+					left_count += buckets[i].count;
+				}
+				costs[i] = left_count > 0 ? left_count * surface_area(left_box) : 0;
+			}
+
+			aabb right_box;
+			int right_count = 0;
+			for (int i = bin_count - 1; i > 0; i--) {
+				if (buckets[i].count > 0) {
+					right_box = right_count == 0 ? buckets[i].box : surrounding_box(right_box, buckets[i].box);
+					right_count += buckets[i].count;
+				}
+				costs[i - 1] += right_count > 0 ? right_count * surface_area(right_box) : 0;
+			}
+
+			for (int i = 0; i < bin_count - 1; i++) {
+				if (costs[i] < best_cost) {
+					best_cost = costs[i];
+					best_axis = a;
+					best_split = i;
+				}
+			}
+		}
+
+		if (best_axis < 0)
+			return -1;
+
+		int count = end - start;
+		double split_cost = options.traversal_cost
+			+ options.intersection_cost * best_cost / surface_area(bounds);
+		double leaf_cost = options.intersection_cost * count;
+
+		if (count <= options.max_sah_leaf_size && leaf_cost <= split_cost)
+			return -1;
+
+		axis = best_axis;
+		double axis_min = centroid_bounds.min()[axis];
+		double axis_extent = centroid_bounds.max()[axis] - axis_min;
+
+		auto mid = std::partition(
+			prim_indices.begin() + start, prim_indices.begin() + end,
+			[&](int index) {
+				return bucket_index(prim_info[index].centroid[axis], axis_min, axis_extent) <= best_split;
+			});
+
+		return static_cast<int>(mid - prim_indices.begin());
+	}
+
+	int bucket_index(double value, double axis_min, double axis_extent) const {
+		int b = static_cast<int>(options.sah_bins * ((value - axis_min) / axis_extent));
+		return b >= options.sah_bins ? options.sah_bins - 1 : b;
+	}
+
+	int depth(int node_index) const {
+		const auto& node = nodes[node_index];
+		if (node.prim_count > 0)
+			return 1;
+		return 1 + std::max(depth(node_index + 1), depth(node.offset));
+	}
+
+	std::vector<primitive_info> prim_info;
+	bvh_build_options options;
+	int max_fork_level = 0;
+	double build_ms = 0;
+};
+
+// Pointer-free BVH over arbitrary hittables. Drop-in replacement for bvh_node:
+// the tree lives in one contiguous array and is traversed with a loop and a
+// small explicit stack instead of recursive virtual calls.
+class flat_bvh : public hittable {
+public:
+	flat_bvh() {}
+
+	flat_bvh(const hittable_list& list, double time0, double time1,
+		const bvh_build_options& options = default_bvh_options())
+		: flat_bvh(list.objects, time0, time1, options)
+	{}
+
+	flat_bvh(const std::vector<shared_ptr<hittable>>& src_objects, double time0, double time1,
+		const bvh_build_options& options = default_bvh_options());
+
+	virtual bool hit(
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+	// Walks the tree once for the whole packet: a node is entered if any lane
+	// hits its box, and primitives only see the lanes that reached them
+	virtual int hit_packet(const ray_packet& packet, int active, real t_min, real* t_max, hit_record* rec) const override;
+
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+		for (const auto& primitive : primitives)
+			primitive->collect_lights(primitive, lights);
+	}
+
+	virtual void collect_primitives(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& out) const override {
+		for (const auto& primitive : primitives)
+			primitive->collect_primitives(primitive, out);
+	}
+
+public:
+	std::vector<linear_bvh_node> nodes;
+	std::vector<shared_ptr<hittable>> primitives;	// ordered so that leaves refer to contiguous ranges
+	bvh_stats stats;
+
+	// The builder caps the tree depth, so the traversal stack can never overflow
+	static const int max_stack_depth = bvh_builder::max_tree_depth + 1;
+};
+
+flat_bvh::flat_bvh(
+	const std::vector<shared_ptr<hittable>>& src_objects, double time0, double time1,
+	const bvh_build_options& options
+) {
+	std::vector<aabb> boxes(src_objects.size());
+	for (size_t i = 0; i < src_objects.size(); i++) {
+		if (!src_objects[i]->bounding_box(time0, time1, boxes[i]))
+			std::cerr << "No bounding box in flat_bvh constructor.\n";
+	}
+
+	bvh_builder builder(boxes, options);
+	stats = builder.stats();
+
+	if (options.report_stats)
+		std::cout << "flat_bvh: " << stats << "\n";
+
+	nodes = std::move(builder.nodes);
+	primitives.reserve(src_objects.size());
+	for (int index : builder.prim_indices)
+		primitives.push_back(src_objects[index]);
+}
+
+bool flat_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	if (nodes.empty())
+		return false;
+
+	const bool dir_is_neg[3] = {
+		r.direction().x() < 0, r.direction().y() < 0, r.direction().z() < 0 };
+
+	int to_visit[max_stack_depth];
+	int to_visit_count = 0;
+	int current = 0;
+	bool hit_anything = false;
+
+	while (true) {
+		const linear_bvh_node& node = nodes[current];
+
+		if (node.box.hit(r, t_min, t_max)) {
+			if (node.prim_count > 0) {
+				for (int i = 0; i < node.prim_count; i++) {
+					if (primitives[node.offset + i]->hit(r, t_min, t_max, rec)) {
+						hit_anything = true;
+						t_max = rec.t;
+					}
+				}
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				// Visit the child nearer to the ray origin first, defer the other one
+				if (dir_is_neg[node.axis]) {
+					to_visit[to_visit_count++] = current + 1;
+					current = node.offset;
+				}
+				else {
+					to_visit[to_visit_count++] = node.offset;
+					current = current + 1;
+				}
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return hit_anything;
+}
+
+int flat_bvh::hit_packet(const ray_packet& packet, int active, real t_min, real* t_max, hit_record* rec) const {
+	if (nodes.empty() || active == 0)
+		return 0;
+
+	// Coherent rays mostly agree on direction signs, so the first lane decides the visiting order
+	int first_lane = 0;
+	while (!(active & (1 << first_lane)))
+		first_lane++;
+	const vec3 first_direction = packet.rays[first_lane].direction();
+	const bool dir_is_neg[3] = {
+		first_direction.x() < 0, first_direction.y() < 0, first_direction.z() < 0 };
+
+	auto box_hit = packet_box_hit();
+
+	int to_visit[max_stack_depth];
+	int to_visit_count = 0;
+	int current = 0;
+	int hits = 0;
+
+	while (true) {
+		const linear_bvh_node& node = nodes[current];
+		int node_lanes = box_hit(node.box, packet, active, t_min, t_max);
+
+		if (node_lanes) {
+			if (node.prim_count > 0) {
+				for (int i = 0; i < node.prim_count; i++)
+					hits |= primitives[node.offset + i]->hit_packet(packet, node_lanes, t_min, t_max, rec);
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				if (dir_is_neg[node.axis]) {
+					to_visit[to_visit_count++] = current + 1;
+					current = node.offset;
+				}
+				else {
+					to_visit[to_visit_count++] = node.offset;
+					current = current + 1;
+				}
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return hits;
+}
+
+bool flat_bvh::bounding_box(double time0, double time1, aabb& output_box) const {
+	if (nodes.empty())
+		return false;
+
+	output_box = nodes[0].box;
+	return true;
+}
+
+#endif // !FLAT_BVH_H
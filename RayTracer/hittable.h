@@ -1,40 +1,142 @@
 #ifndef  HITTABLE_H
 #define HITTABLE_H
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 #include "aabb.h"
 #include "rtcommon.h"
 #include "ray.h"
+#include "simd.h"
 
 class material;
+class hittable;
+class hittable_list;
+
+// The primitives compiled_scene intersects without virtual calls
+enum class hittable_kind { other, sphere, moving_sphere, xy_rect, xz_rect, yz_rect, box };
 
 struct hit_record {
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat_ptr;
-	double t;
-	double u;
-	double v;
+	const material* mat_ptr = nullptr;	// owned by the primitive that was hit
+	real t;
+	real u;
+	real v;
 	bool front_face;
+	int material_index = -1;	// index of mat_ptr in a compiled_scene, -1 if it has none
+
+	// A hit found during traversal only has t and what its object needs to
+	// find it again: the primitive's index within the object and the
+	// barycentric coordinates of triangle hits. pending is that object until
+	// finish() has filled in the rest, nullptr after.
+	const hittable* pending = nullptr;
+	int primitive;
+	real b0, b1, b2;
+
+	// Fills in the surface interaction of the closest hit, with r the ray it
+	// was found with. If m is set, it replaces the material of the hit.
+	void finish(const ray& r, const material* m = nullptr);
 
 	inline void set_face_normal(const ray& r, const vec3& outward_normal) {
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
 	}
+
+	// Origin for a ray leaving the surface in direction w. Computed hit points
+	// are off the surface by rounding errors that grow with their magnitude, so
+	// the origin is pushed along the normal, to the side w leaves to, by a few
+	// ulps of the largest coordinate. Negligible in double builds; in float
+	// builds it keeps rays from hitting the surface they start on again.
+	point3 spawn_origin(const vec3& w) const {
+		real magnitude = std::max(std::fabs(p.x()), std::max(std::fabs(p.y()), std::fabs(p.z())));
+		real offset = (magnitude + 1) * 64 * std::numeric_limits<real>::epsilon();
+		return dot(w, normal) < 0 ? p - offset * normal : p + offset * normal;
+	}
 };
 
 class hittable {
 public:
-	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+	// Closest intersection with r in [t_min, t_max]. A hit sets rec.t, and
+	// either fills in the rest of rec or leaves that to surface() by setting
+	// rec.pending, so hits that later lose to a closer one cost no more than
+	// finding them. rec is left alone on a miss.
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+	// Fills in p, normal, front_face and mat_ptr of a hit this object left
+	// pending, and u and v if the material uses them. rec.mat_ptr is only set
+	// if it is still nullptr, so a material override given to finish() wins.
+	virtual void surface(const ray& r, hit_record& rec) const {}
+
+	// hit for the rays of packet selected by active: every lane that hits
+	// something closer than t_max[lane] gets rec[lane] filled in and t_max[lane]
+	// lowered to the hit. Returns the mask of lanes that hit. Objects that can
+	// test several rays at once override the one-ray-at-a-time default.
+	virtual int hit_packet(const ray_packet& packet, int active, real t_min, real* t_max, hit_record* rec) const {
+		int hits = 0;
+		for (int lane = 0; lane < ray_packet::size; lane++) {
+			if ((active & (1 << lane)) && hit(packet.rays[lane], t_min, t_max[lane], rec[lane])) {
+				t_max[lane] = rec[lane].t;
+				hits |= 1 << lane;
+			}
+		}
+		return hits;
+	}
+
+	// Light sampling. random returns a direction from origin towards a random
+	// point of the object, pdf_value the solid angle density of that choice.
+	// Only objects that can be sampled as lights override these.
+	virtual double pdf_value(const point3& origin, const vec3& direction) const {
+		return 0.0;
+	}
+
+	virtual vec3 random(const point3& origin) const {
+		return vec3(1, 0, 0);
+	}
+
+	// Adds every emissive object that supports light sampling to lights. self is
+	// the owning pointer to this object. Containers forward to their children;
+	// transformed objects are not collected, their emission is only found by
+	// paths that hit them.
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const {}
+
+	// Adds the objects a compiled_scene is made of to out. Lists and BVHs
+	// forward to their children, everything else adds self.
+	virtual void collect_primitives(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& out) const {
+		out.push_back(self);
+	}
+
+	// Concrete type of a primitive compiled_scene knows, other for the rest
+	virtual hittable_kind kind() const {
+		return hittable_kind::other;
+	}
 };
 
+inline void hit_record::finish(const ray& r, const material* m) {
+	if (pending) {
+		const hittable* object = pending;
+		pending = nullptr;
+		mat_ptr = m;
+		object->surface(r, *this);
+	}
+	else if (m) {
+		mat_ptr = m;
+	}
+}
+
+// The transforms finish the hits they find right away, since the surface
+// has to be computed with the transformed ray. An instance material override
+// on top of them therefore only gets u and v if the object's own material
+// uses them; instance is the transform to use for those.
 class translate : public hittable {
 public:
 	translate(shared_ptr<hittable> p, const vec3& displacement)
 		: ptr(p), offset(displacement) {}
 
 	virtual bool hit(
-		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
@@ -43,11 +145,12 @@ public:
 	vec3 offset;
 };
 
-bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool translate::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	ray moved_r(r.origin() - offset, r.direction(), r.time());
 	if (!ptr->hit(moved_r, t_min, t_max, rec))
 		return false;
 
+	rec.finish(moved_r);
 	rec.p += offset;
 	rec.set_face_normal(moved_r, rec.normal);
 
@@ -70,7 +173,7 @@ public:
 	rotate_y(shared_ptr<hittable> p, double angle);
 
 	virtual bool hit(
-		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
 		output_box = bbox;
@@ -79,8 +182,8 @@ public:
 
 public:
 	shared_ptr<hittable> ptr;
-	double sin_theta;
-	double cos_theta;
+	real sin_theta;
+	real cos_theta;
 	bool hasbox;
 	aabb bbox;
 };
@@ -117,7 +220,7 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
 	bbox = aabb(min, max);
 }
 
-bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool rotate_y::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	auto origin = r.origin();
 	auto direction = r.direction();
 
@@ -132,6 +235,7 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 	if (!ptr->hit(rotated_r, t_min, t_max, rec))
 		return false;
 
+	rec.finish(rotated_r);
 	auto p = rec.p;
 	auto normal = rec.normal;
 
@@ -18,25 +18,45 @@ public:
 	void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
 	virtual bool hit(
-		const ray& r, double tmin, double tmax, hit_record& rec) const override;
+		const ray& r, real tmin, real tmax, hit_record& rec) const override;
 
 	virtual bool bounding_box(
 		double time0, double time1, aabb& output_box) const override;
 
+	virtual int hit_packet(const ray_packet& packet, int active, real t_min, real* t_max, hit_record* rec) const override {
+		int hits = 0;
+		for (const auto& object : objects)
+			hits |= object->hit_packet(packet, active, t_min, t_max, rec);
+		return hits;
+	}
+
+	// Uniform mixture of the objects' light sampling densities
+	virtual double pdf_value(const point3& origin, const vec3& direction) const override;
+	virtual vec3 random(const point3& origin) const override;
+
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+		for (const auto& object : objects)
+			object->collect_lights(object, lights);
+	}
+
+	virtual void collect_primitives(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& out) const override {
+		for (const auto& object : objects)
+			object->collect_primitives(object, out);
+	}
+
 public:
 	std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	hit_record temp_rec;
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	bool hit_anything = false;
 	auto closest_so_far = t_max;
 
+	// Objects only write rec when they hit closer than closest_so_far
 	for (const auto& object : objects) {
-		if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+		if (object->hit(r, t_min, closest_so_far, rec)) {
 			hit_anything = true;
-			closest_so_far = temp_rec.t;
-			rec = temp_rec;
+			closest_so_far = rec.t;
 		}
 	}
 
@@ -58,4 +78,30 @@ bool hittable_list::bounding_box(double time0, double time1, aabb& output_box) c
 	return true;
 }
 
+double hittable_list::pdf_value(const point3& origin, const vec3& direction) const {
+	if (objects.empty())
+		return 0.0;
+
+	auto weight = 1.0 / objects.size();
+	auto sum = 0.0;
+
+	for (const auto& object : objects)
+		sum += weight * object->pdf_value(origin, direction);
+
+	return sum;
+}
+
+vec3 hittable_list::random(const point3& origin) const {
+	auto int_size = static_cast<int>(objects.size());
+	return objects[random_int(0, int_size - 1)]->random(origin);
+}
+
+// Collects the emissive objects of a scene, for next event estimation
+hittable_list collect_lights(const hittable_list& world) {
+	hittable_list lights;
+	for (const auto& object : world.objects)
+		object->collect_lights(object, lights);
+	return lights;
+}
+
 #endif // ! HITTABLE_LIST_H
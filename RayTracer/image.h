@@ -1,12 +1,17 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "rtcommon.h"
 #include "color.h"
+#include "rt_stb_image.h"
 
 class image {
 public:
@@ -17,67 +22,182 @@ public:
 		, num_pixels_total(width * height)
 	{
 		pixels = new color[width * height];
+		sample_counts = new unsigned int[width * height]();
+		luminance_squares = new double[width * height]();
+		converged = new unsigned char[width * height]();
 		pixels_completed = 0;
+		samples_completed = 0;
 	}
 
 	~image() {
 		delete[] pixels;
+		delete[] sample_counts;
+		delete[] luminance_squares;
+		delete[] converged;
 	}
 
-	void set_color(int y, int x, color c)
+	// Accumulates the sum of num_samples more samples into a pixel, along with
+	// the sum of their squared luminances for the variance estimate. Every pixel
+	// keeps its own count, so a frame interrupted between or during passes, or
+	// sampled adaptively, still averages correctly.
+	void add_samples(int y, int x, color sum, double luminance_square_sum, unsigned int num_samples)
 	{
-		pixels[width * y + x] = c;
-		pixels_completed += 1;
+		pixels[width * y + x] += sum;
+		luminance_squares[width * y + x] += luminance_square_sum;
+		sample_counts[width * y + x] += num_samples;
+		samples_completed += num_samples;
+		int completed = ++pixels_completed;
 		
-		if (pixels_completed % 1000 == 0)
+		if (completed % 1000 == 0)
 			print_progress();
 	}
 
-	void write_image(std::string filename) {
-		std::ofstream file;
-		file.open(filename);
-
-		file << "P3\n" << this->width << " " << this->height << "\n255\n";
-
-		for (unsigned i = 0; i < this->width * this->height; i++) {
-			auto pixel_color = pixels[i];
-			auto r = pixel_color.x();
-			auto g = pixel_color.y();
-			auto b = pixel_color.z();
-
-			// Divide the color by the number of samples and gamma correct for gamma=2.0
-			auto scale = 1.0 / samples_per_pixel;
-			//auto scale = 1.0;
-			r = sqrt(scale * r);
-			g = sqrt(scale * g);
-			b = sqrt(scale * b);
-
-			// Write the translated [0,255] value of each color component
-			file << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-				<< static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-				<< static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+	// Writes the image in the format its file name ends in: .png, .bmp, .tga,
+	// .jpg, .hdr (linear, unclamped radiance) or, for anything else, plain PPM.
+	// Returns false if the file could not be written.
+	bool write_image(const std::string& filename) {
+		std::string extension = file_extension(filename);
+		bool ok;
+
+		if (extension == "hdr") {
+			std::vector<float> radiance(3 * num_pixels_total);
+			for (unsigned i = 0; i < num_pixels_total; i++) {
+				auto scale = sample_scale(i);
+				for (int k = 0; k < 3; k++)
+					radiance[3 * i + k] = static_cast<float>(scale * pixels[i][k]);
+			}
+			ok = stbi_write_hdr(filename.c_str(), width, height, 3, radiance.data()) != 0;
 		}
+		else if (extension == "png" || extension == "bmp" || extension == "tga" || extension == "jpg" || extension == "jpeg") {
+			std::vector<unsigned char> rgb(3 * num_pixels_total);
+			for (unsigned i = 0; i < num_pixels_total; i++)
+				to_rgb8(i, &rgb[3 * i]);
+			const char* name = filename.c_str();
+			if (extension == "png")
+				ok = stbi_write_png(name, width, height, 3, rgb.data(), 3 * width) != 0;
+			else if (extension == "bmp")
+				ok = stbi_write_bmp(name, width, height, 3, rgb.data()) != 0;
+			else if (extension == "tga")
+				ok = stbi_write_tga(name, width, height, 3, rgb.data()) != 0;
+			else
+				ok = stbi_write_jpg(name, width, height, 3, rgb.data(), 95) != 0;
+		}
+		else {
+			std::ofstream file;
+			file.open(filename);
+
+			file << "P3\n" << this->width << " " << this->height << "\n255\n";
+
+			for (unsigned i = 0; i < this->width * this->height; i++) {
+				unsigned char rgb[3];
+				to_rgb8(i, rgb);
+				file << static_cast<int>(rgb[0]) << ' ' << static_cast<int>(rgb[1]) << ' ' << static_cast<int>(rgb[2]) << '\n';
+			}
 
-		file.close();
+			file.close();
+			ok = !file.fail();
+		}
 
+		if (!ok) {
+			std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+			return false;
+		}
 		std::cout << "\nsaved as " << filename << std::endl;
+		return true;
+	}
+
+	bool is_converged(int y, int x) const
+	{
+		return converged[width * y + x] != 0;
+	}
+
+	// Marks every pixel with at least min_samples whose relative error is below
+	// threshold as converged. The error is the standard error of the pixel's
+	// mean luminance relative to the mean, from the pixel's own samples. A
+	// pixel only converges once its 3x3 neighbourhood has too: one whose few
+	// samples all came out the same (e.g. all black because no path found the
+	// light yet) has no variance, but its neighbours are still noisy. The small
+	// bias in the denominator keeps dark pixels from needing an absurd number
+	// of samples. Must not run while samples are being added. Returns the
+	// number of pixels that still need samples.
+	unsigned int update_convergence(unsigned int min_samples, double threshold)
+	{
+		std::vector<double> errors(num_pixels_total);
+		for (unsigned i = 0; i < num_pixels_total; i++) {
+			auto n = sample_counts[i];
+			if (n < min_samples || n < 2) {
+				errors[i] = infinity;
+				continue;
+			}
+			auto mean = luminance(pixels[i]) / n;
+			auto variance = (luminance_squares[i] / n - mean * mean) * n / (n - 1);
+			errors[i] = variance > 0 ? sqrt(variance / n) / (mean + 1e-3) : 0.0;
+		}
+
+		unsigned int remaining = 0;
+		for (int y = 0; y < (int)height; y++) {
+			for (int x = 0; x < (int)width; x++) {
+				double error = 0;
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dx = -1; dx <= 1; dx++) {
+						int ny = y + dy, nx = x + dx;
+						if (ny >= 0 && ny < (int)height && nx >= 0 && nx < (int)width)
+							error = std::max(error, errors[width * ny + nx]);
+					}
+				}
+
+				converged[width * y + x] = error < threshold ? 1 : 0;
+				if (!converged[width * y + x])
+					remaining++;
+			}
+		}
+
+		return remaining;
 	}
 
 	float approx_completion()
 	{
-		return (float)pixels_completed / num_pixels_total;
+		return (float)samples_completed / ((double)num_pixels_total * samples_per_pixel);
 	}
 
 
 	void print_progress()
 	{
-		std::cerr << "\r" << approx_completion() * 100 << "%" << "(" << pixels_completed << " of " << num_pixels_total << ")" << std::flush;
+		std::cerr << "\r" << approx_completion() * 100 << "%" << "(" << samples_completed << " of "
+			<< (unsigned long long)num_pixels_total * samples_per_pixel << " samples)" << std::flush;
+	}
+
+private:
+	double sample_scale(unsigned i) const {
+		return sample_counts[i] > 0 ? 1.0 / sample_counts[i] : 0.0;
+	}
+
+	// Divides the color of pixel i by its number of samples, gamma corrects for
+	// gamma=2.0 and translates to [0,255] values
+	void to_rgb8(unsigned i, unsigned char* rgb) const {
+		auto scale = sample_scale(i);
+		for (int k = 0; k < 3; k++)
+			rgb[k] = static_cast<unsigned char>(256 * clamp(sqrt(scale * pixels[i][k]), 0.0, 0.999));
+	}
+
+	static std::string file_extension(const std::string& filename) {
+		size_t dot = filename.find_last_of('.');
+		if (dot == std::string::npos || filename.find_first_of("/\\", dot) != std::string::npos)
+			return "";
+		std::string extension = filename.substr(dot + 1);
+		for (auto& c : extension)
+			c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		return extension;
 	}
 
 public:
 	color *pixels;
+	unsigned int *sample_counts;
+	double *luminance_squares;
+	unsigned char *converged;
 	const unsigned int height, width, samples_per_pixel, num_pixels_total;
-	int pixels_completed;
+	std::atomic<int> pixels_completed;
+	std::atomic<unsigned long long> samples_completed;
 };
 
 #endif // !IMAGE_H
@@ -0,0 +1,172 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "transform.h"
+#include "wide_bvh.h"
+
+// Places an object (usually a BVH, mesh or sphere_set) in the scene under an
+// affine transform. The ray is taken into object space once, and only the
+// closest hit is brought back.
+struct instance_record {
+	affine_transform to_world;
+	affine_transform to_object;
+	const hittable* object;
+	shared_ptr<material> material_override;	// replaces the object's materials if set
+
+	// Ray in the object's space. The direction is not normalized, so distances
+	// along it are the same in both spaces.
+	ray object_ray(const ray& r) const {
+		return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+	}
+
+	// Turns a hit found with object_r, the object_ray of the world ray, into a
+	// finished world space hit
+	void to_world_hit(const ray& object_r, hit_record& rec) const {
+		rec.finish(object_r, material_override.get());
+		rec.p = to_world.point(rec.p);
+		// Normals transform with the inverse transpose; the side the ray came from stays the same
+		rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+	}
+};
+
+// A single transformed object, the general form of translate and rotate_y
+class instance : public hittable {
+public:
+	instance(shared_ptr<hittable> p, const affine_transform& to_world, shared_ptr<material> m = nullptr)
+		: ptr(p)
+	{
+		record = { to_world, to_world.inverse(), ptr.get(), m };
+	}
+
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+		ray object_r = record.object_ray(r);
+		if (!ptr->hit(object_r, t_min, t_max, rec))
+			return false;
+		record.to_world_hit(object_r, rec);
+		return true;
+	}
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+		if (!ptr->bounding_box(time0, time1, output_box))
+			return false;
+		output_box = record.to_world.box(output_box);
+		return true;
+	}
+
+public:
+	shared_ptr<hittable> ptr;
+	instance_record record;
+};
+
+// Top level acceleration structure: a wide BVH over instances of shared
+// bottom level objects. Each object is stored once however often it is
+// placed, so a copy only costs an instance_record and its share of the top
+// level tree. Add all instances, then call build() once before rendering.
+class instance_bvh : public hittable {
+public:
+	instance_bvh() {}
+
+	void add(shared_ptr<hittable> object, const affine_transform& to_world, shared_ptr<material> m = nullptr);
+
+	void build(double time0, double time1, const bvh_build_options& options = default_bvh_options());
+
+	virtual bool hit(
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+		if (nodes.empty())
+			return false;
+		output_box = box;
+		return true;
+	}
+
+	// Emissive instances are not sampled by next event estimation; they still
+	// light the scene through the paths that hit them
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {}
+
+public:
+	std::vector<instance_record> instances;	// in leaf order after build()
+	std::vector<shared_ptr<hittable>> objects;	// every instanced object once
+
+	std::vector<wide_bvh_node> nodes;
+	aabb box;
+	bvh_stats binary_stats;
+	wide_bvh_stats stats;
+
+private:
+	std::unordered_map<const hittable*, int> object_lookup;
+};
+
+void instance_bvh::add(shared_ptr<hittable> object, const affine_transform& to_world, shared_ptr<material> m) {
+	if (object_lookup.find(object.get()) == object_lookup.end()) {
+		object_lookup[object.get()] = static_cast<int>(objects.size());
+		objects.push_back(object);
+	}
+	instances.push_back({ to_world, to_world.inverse(), object.get(), m });
+}
+
+void instance_bvh::build(double time0, double time1, const bvh_build_options& options) {
+	// Every object's box is computed once and transformed per instance
+	std::vector<aabb> object_boxes(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		if (!objects[i]->bounding_box(time0, time1, object_boxes[i]))
+			std::cerr << "No bounding box in instance_bvh::build.\n";
+	}
+
+	std::vector<aabb> boxes(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+		boxes[i] = instances[i].to_world.box(object_boxes[object_lookup[instances[i].object]]);
+
+	bvh_builder builder(boxes, options);
+	binary_stats = builder.stats();
+
+	nodes.clear();
+	if (!builder.nodes.empty()) {
+		box = builder.nodes[0].box;
+		collapse_bvh(builder.nodes, 0, nodes);
+	}
+	stats = wide_stats(nodes);
+
+	std::vector<instance_record> sorted;
+	sorted.reserve(instances.size());
+	for (int index : builder.prim_indices)
+		sorted.push_back(instances[index]);
+	instances = std::move(sorted);
+
+	if (options.report_stats)
+		std::cout << "instance_bvh: " << instances.size() << " instances of " << objects.size() << " objects, "
+			<< binary_stats << ", " << stats << "\n";
+}
+
+bool instance_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	int best = -1;
+
+	traverse_wide_bvh(nodes, r, t_min, t_max, [&](int first, int count, real& closest) {
+		bool hit_leaf = false;
+		for (int i = first; i < first + count; i++) {
+			// rec is only finished and brought to world space for the closest instance, after traversal
+			if (instances[i].object->hit(instances[i].object_ray(r), t_min, closest, rec)) {
+				closest = rec.t;
+				best = i;
+				hit_leaf = true;
+			}
+		}
+		return hit_leaf;
+	});
+
+	if (best < 0)
+		return false;
+
+	instances[best].to_world_hit(instances[best].object_ray(r), rec);
+	return true;
+}
+
+#endif // !INSTANCE_H
@@ -0,0 +1,230 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <algorithm>
+
+#include "rtcommon.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+
+enum class integrator_type {
+	recursive,	// ray_color, one recursion level per bounce
+	iterative,	// ray_color_iterative, throughput tracking and Russian roulette
+	nee		// ray_color_nee, iterative plus direct light sampling
+};
+
+// Camera ray intersection computed ahead of the integrator, e.g. in a ray packet
+struct primary_hit {
+	bool hit;
+	hit_record rec;
+};
+
+// What the iterative integrators need from the scene, through the virtual
+// hittable and material interfaces. compiled_scene offers the same members
+// with switch dispatch over a closed set of types.
+struct virtual_world {
+	explicit virtual_world(const hittable& world) : objects(world) {}
+
+	bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+		return objects.hit(r, t_min, t_max, rec);
+	}
+
+	void finish(const ray& r, hit_record& rec) const {
+		rec.finish(r);
+	}
+
+	color emitted(const hit_record& rec) const {
+		return rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+	}
+
+	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+		return rec.mat_ptr->scatter(r_in, rec, attenuation, scattered);
+	}
+
+	double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+		return rec.mat_ptr->scattering_pdf(r_in, rec, scattered);
+	}
+
+	const hittable& objects;
+};
+
+// Rays traced by the current thread, summed up per tile for the rays/sec report
+thread_local unsigned long long thread_rays_traced = 0;
+
+color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
+	hit_record rec;
+
+	// If we've exceeded the ray bounce limit, no more light is gathered.
+	if (depth <= 0)
+		return color(0, 0, 0);
+
+	thread_rays_traced++;
+
+	// If the ray hits nothing, return the background color.
+	if (!world.hit(r, 0.001, infinity, rec))
+		return background;
+	rec.finish(r);
+
+	ray scattered;
+	color attenuation;
+	color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+	if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+		return emitted;
+
+	return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
+}
+
+// Same estimator as ray_color, written as a loop. The product of attenuations
+// along the path is carried as throughput, and after roulette_depth bounces a
+// path survives each bounce with a probability equal to its throughput (capped
+// at 0.95). Survivors are reweighted by 1/p, so the estimate stays unbiased
+// while dim paths stop early instead of running to max_depth.
+// If primary is given, it is used instead of intersecting r_in with the world.
+// world is a virtual_world or a compiled_scene.
+template <typename world_type>
+color ray_color_iterative(
+	const ray& r_in, const color& background, const world_type& world, int max_depth, int roulette_depth,
+	const primary_hit* primary = nullptr) {
+	color radiance(0, 0, 0);
+	color throughput(1, 1, 1);
+	ray r = r_in;
+
+	for (int depth = 0; depth < max_depth; depth++) {
+		hit_record rec;
+		bool found;
+
+		if (depth == 0 && primary) {
+			found = primary->hit;
+			rec = primary->rec;
+		}
+		else {
+			thread_rays_traced++;
+			found = world.hit(r, 0.001, infinity, rec);
+		}
+
+		if (!found) {
+			radiance += throughput * background;
+			break;
+		}
+		world.finish(r, rec);
+
+		radiance += throughput * world.emitted(rec);
+
+		ray scattered;
+		color attenuation;
+		if (!world.scatter(r, rec, attenuation, scattered))
+			break;
+
+		throughput = throughput * attenuation;
+
+		if (depth + 1 >= roulette_depth) {
+			double survival = std::min(0.95, static_cast<double>(std::max(throughput.x(), std::max(throughput.y(), throughput.z()))));
+			if (random_double() >= survival)
+				break;
+			throughput /= survival;
+		}
+
+		r = scattered;
+	}
+
+	return radiance;
+}
+
+// Veach's power heuristic (beta = 2) for combining two sampling strategies
+inline double power_heuristic(double pdf_a, double pdf_b) {
+	auto a = pdf_a * pdf_a;
+	auto b = pdf_b * pdf_b;
+	return a + b > 0 ? a / (a + b) : 0;
+}
+
+// ray_color_iterative with next event estimation. At every diffuse bounce a
+// shadow ray is sent towards a random point on one of the lights, and the
+// emission it reaches is added right away. Emission found by the scattered
+// ray is still counted, so both strategies are combined with multiple
+// importance sampling: each is weighted by the power heuristic of the two
+// densities for its direction. Specular bounces cannot be light sampled,
+// the emission they hit counts in full.
+template <typename world_type>
+color ray_color_nee(
+	const ray& r_in, const color& background, const world_type& world, const hittable_list& lights,
+	int max_depth, int roulette_depth, const primary_hit* primary = nullptr) {
+	color radiance(0, 0, 0);
+	color throughput(1, 1, 1);
+	ray r = r_in;
+
+	// Density of the direction of r at its origin, 0 for camera rays and after specular bounces
+	double scatter_pdf = 0;
+	bool sample_lights = !lights.objects.empty();
+
+	for (int depth = 0; depth < max_depth; depth++) {
+		hit_record rec;
+		bool found;
+
+		if (depth == 0 && primary) {
+			found = primary->hit;
+			rec = primary->rec;
+		}
+		else {
+			thread_rays_traced++;
+			found = world.hit(r, 0.001, infinity, rec);
+		}
+
+		if (!found) {
+			radiance += throughput * background;
+			break;
+		}
+		world.finish(r, rec);
+
+		color emitted = world.emitted(rec);
+		if (emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0) {
+			double weight = 1;
+			if (scatter_pdf > 0)
+				weight = power_heuristic(scatter_pdf, lights.pdf_value(r.origin(), r.direction()));
+			radiance += throughput * emitted * weight;
+		}
+
+		ray scattered;
+		color attenuation;
+		if (!world.scatter(r, rec, attenuation, scattered))
+			break;
+
+		scatter_pdf = sample_lights ? world.scattering_pdf(r, rec, scattered) : 0;
+
+		if (scatter_pdf > 0) {
+			vec3 light_direction = lights.random(rec.p);
+			ray to_light(rec.spawn_origin(light_direction), light_direction, r.time());
+			double light_pdf = lights.pdf_value(to_light.origin(), to_light.direction());
+			double light_scatter_pdf = world.scattering_pdf(r, rec, to_light);
+
+			// attenuation * scattering_pdf is the BRDF times the cosine term
+			hit_record light_rec;
+			if (light_pdf > 0 && light_scatter_pdf > 0) {
+				thread_rays_traced++;
+				if (world.hit(to_light, 0.001, infinity, light_rec)) {
+					world.finish(to_light, light_rec);
+					color light = world.emitted(light_rec);
+					double weight = power_heuristic(light_pdf, light_scatter_pdf);
+					radiance += throughput * attenuation * light * (light_scatter_pdf / light_pdf * weight);
+				}
+			}
+		}
+
+		throughput = throughput * attenuation;
+
+		if (depth + 1 >= roulette_depth) {
+			double survival = std::min(0.95, static_cast<double>(std::max(throughput.x(), std::max(throughput.y(), throughput.z()))));
+			if (random_double() >= survival)
+				break;
+			throughput /= survival;
+		}
+
+		r = scattered;
+	}
+
+	return radiance;
+}
+
+#endif // !INTEGRATOR_H
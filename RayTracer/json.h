@@ -0,0 +1,414 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "obj_loader.h"
+
+enum class json_type { null, boolean, number, string, array, object };
+
+// A parsed JSON value. Objects keep their members in file order as parallel
+// key and value arrays; scene files have few keys per object, so a linear
+// find() beats hashing.
+class json_value {
+public:
+	bool is_null() const { return type == json_type::null; }
+	bool is_bool() const { return type == json_type::boolean; }
+	bool is_number() const { return type == json_type::number; }
+	bool is_string() const { return type == json_type::string; }
+	bool is_array() const { return type == json_type::array; }
+	bool is_object() const { return type == json_type::object; }
+
+	// Member called key, nullptr if there is none or this is not an object
+	const json_value* find(const char* key) const {
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (keys[i] == key)
+				return &values[i];
+		}
+		return nullptr;
+	}
+
+	// Number of array elements or object members
+	size_t size() const { return values.size(); }
+
+	const json_value& operator [] (size_t i) const { return values[i]; }
+
+public:
+	json_type type = json_type::null;
+	bool boolean = false;
+	double number = 0;
+	std::string string;
+	std::vector<std::string> keys;		// object member names
+	std::vector<json_value> values;		// array elements or object member values
+	int line = 0;				// where the value starts, for error messages
+};
+
+// Recursive descent parser that builds the values in a single pass over the
+// text, without a separate tokenizer. Accepts standard JSON plus // and /* */
+// comments, which scene files find useful.
+class json_parser {
+public:
+	// False on a syntax error, which is then described by error
+	bool parse(const char* text, size_t length, json_value& result) {
+		begin = p = text;
+		end = text + length;
+		line = 1;
+		error.clear();
+
+		skip_space();
+		if (!parse_value(result, 0))
+			return false;
+		skip_space();
+		if (p != end)
+			return fail("unexpected text after the end of the document");
+		return true;
+	}
+
+public:
+	std::string error;
+
+private:
+	// Deeper documents would only come from broken or hostile files
+	static const int max_depth = 256;
+
+	bool fail(const char* message) {
+		if (error.empty()) {
+			size_t column = 1;
+			for (const char* c = p; c > begin && c[-1] != '\n'; c--)
+				column++;
+			error = "line " + std::to_string(line) + ", column " + std::to_string(column) + ": " + message;
+		}
+		return false;
+	}
+
+	void skip_space() {
+		while (p < end) {
+			char c = *p;
+			if (c == '\n') {
+				line++;
+				p++;
+			}
+			else if (c == ' ' || c == '\t' || c == '\r') {
+				p++;
+			}
+			else if (c == '/' && p + 1 < end && p[1] == '/') {
+				while (p < end && *p != '\n')
+					p++;
+			}
+			else if (c == '/' && p + 1 < end && p[1] == '*') {
+				for (p += 2; p < end && !(*p == '*' && p + 1 < end && p[1] == '/'); p++)
+					line += *p == '\n';
+				p = p < end ? p + 2 : end;
+			}
+			else {
+				return;
+			}
+		}
+	}
+
+	bool match(const char* word) {
+		size_t n = std::strlen(word);
+		if (static_cast<size_t>(end - p) < n || std::memcmp(p, word, n) != 0)
+			return false;
+		p += n;
+		return true;
+	}
+
+	bool parse_value(json_value& v, int depth) {
+		if (depth > max_depth)
+			return fail("nesting too deep");
+		if (p == end)
+			return fail("unexpected end of the document");
+
+		v.line = line;
+		switch (*p) {
+		case '{':
+			return parse_object(v, depth);
+		case '[':
+			return parse_array(v, depth);
+		case '"':
+			v.type = json_type::string;
+			return parse_string(v.string);
+		case 't':
+			v.type = json_type::boolean;
+			v.boolean = true;
+			return match("true") || fail("invalid literal");
+		case 'f':
+			v.type = json_type::boolean;
+			v.boolean = false;
+			return match("false") || fail("invalid literal");
+		case 'n':
+			v.type = json_type::null;
+			return match("null") || fail("invalid literal");
+		default:
+			return parse_number(v);
+		}
+	}
+
+	bool parse_object(json_value& v, int depth) {
+		v.type = json_type::object;
+		// Most objects in scene files are small; this saves the first few regrowths
+		v.keys.reserve(4);
+		v.values.reserve(4);
+		p++;
+		skip_space();
+		if (p < end && *p == '}') {
+			p++;
+			return true;
+		}
+		while (true) {
+			if (p == end || *p != '"')
+				return fail("expected a member name");
+			v.keys.emplace_back();
+			if (!parse_string(v.keys.back()))
+				return false;
+			skip_space();
+			if (p == end || *p != ':')
+				return fail("expected ':'");
+			p++;
+			skip_space();
+			v.values.emplace_back();
+			if (!parse_value(v.values.back(), depth + 1))
+				return false;
+			skip_space();
+			if (p < end && *p == ',') {
+				p++;
+				skip_space();
+				continue;
+			}
+			if (p < end && *p == '}') {
+				p++;
+				return true;
+			}
+			return fail("expected ',' or '}'");
+		}
+	}
+
+	bool parse_array(json_value& v, int depth) {
+		v.type = json_type::array;
+		v.values.reserve(4);
+		p++;
+		skip_space();
+		if (p < end && *p == ']') {
+			p++;
+			return true;
+		}
+		while (true) {
+			v.values.emplace_back();
+			if (!parse_value(v.values.back(), depth + 1))
+				return false;
+			skip_space();
+			if (p < end && *p == ',') {
+				p++;
+				skip_space();
+				continue;
+			}
+			if (p < end && *p == ']') {
+				p++;
+				return true;
+			}
+			return fail("expected ',' or ']'");
+		}
+	}
+
+	bool parse_string(std::string& s) {
+		p++;
+		while (true) {
+			// Copy the run of plain characters up to the next quote or escape at once
+			const char* run = p;
+			while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20)
+				p++;
+			s.append(run, p);
+
+			if (p == end)
+				return fail("unterminated string");
+			if (*p == '"') {
+				p++;
+				return true;
+			}
+			if (*p != '\\')
+				return fail("control character in string");
+
+			if (++p == end)
+				return fail("unterminated string");
+			switch (*p++) {
+			case '"': s += '"'; break;
+			case '\\': s += '\\'; break;
+			case '/': s += '/'; break;
+			case 'b': s += '\b'; break;
+			case 'f': s += '\f'; break;
+			case 'n': s += '\n'; break;
+			case 'r': s += '\r'; break;
+			case 't': s += '\t'; break;
+			case 'u': {
+				uint32_t code = 0;
+				if (!parse_hex4(code))
+					return false;
+				// A surrogate pair encodes one code point above U+FFFF
+				if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+					p += 2;
+					uint32_t low = 0;
+					if (!parse_hex4(low))
+						return false;
+					if (low < 0xDC00 || low >= 0xE000)
+						return fail("invalid surrogate pair");
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				append_utf8(s, code);
+				break;
+			}
+			default:
+				p--;
+				return fail("invalid escape sequence");
+			}
+		}
+	}
+
+	bool parse_hex4(uint32_t& code) {
+		if (end - p < 4)
+			return fail("invalid \\u escape");
+		code = 0;
+		for (int i = 0; i < 4; i++, p++) {
+			char c = *p;
+			int digit = c >= '0' && c <= '9' ? c - '0'
+				: c >= 'a' && c <= 'f' ? c - 'a' + 10
+				: c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+			if (digit < 0)
+				return fail("invalid \\u escape");
+			code = code * 16 + digit;
+		}
+		return true;
+	}
+
+	static void append_utf8(std::string& s, uint32_t code) {
+		if (code < 0x80) {
+			s += static_cast<char>(code);
+		}
+		else if (code < 0x800) {
+			s += static_cast<char>(0xC0 | (code >> 6));
+			s += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			s += static_cast<char>(0xE0 | (code >> 12));
+			s += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			s += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else {
+			s += static_cast<char>(0xF0 | (code >> 18));
+			s += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+			s += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			s += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+
+	// Checks the JSON number grammar, then converts with the OBJ loader's
+	// parser, which handles everything JSON allows
+	bool parse_number(json_value& v) {
+		const char* start = p;
+		const char* c = p;
+		if (c < end && *c == '-')
+			c++;
+		if (c == end || !(*c >= '0' && *c <= '9'))
+			return fail("unexpected character");
+		if (*c == '0')
+			c++;
+		else
+			while (c < end && *c >= '0' && *c <= '9')
+				c++;
+		if (c < end && *c == '.') {
+			if (++c == end || !(*c >= '0' && *c <= '9'))
+				return fail("invalid number");
+			while (c < end && *c >= '0' && *c <= '9')
+				c++;
+		}
+		if (c < end && (*c == 'e' || *c == 'E')) {
+			c++;
+			if (c < end && (*c == '+' || *c == '-'))
+				c++;
+			if (c == end || !(*c >= '0' && *c <= '9'))
+				return fail("invalid number");
+			while (c < end && *c >= '0' && *c <= '9')
+				c++;
+		}
+
+		// obj_parse_double stops at the first character that can't continue the
+		// number, which needs a terminator the text may not have at its very end
+		v.type = json_type::number;
+		if (c < end) {
+			v.number = obj_parse_double(start);
+		}
+		else {
+			std::string tail(start, c);
+			const char* s = tail.c_str();
+			v.number = obj_parse_double(s);
+		}
+		p = c;
+		return true;
+	}
+
+	const char* begin = nullptr;
+	const char* p = nullptr;
+	const char* end = nullptr;
+	int line = 1;
+};
+
+// Reads and parses a whole JSON file, printing an ERROR on failure
+inline bool parse_json_file(const std::string& path, json_value& result) {
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file) {
+		std::cerr << "ERROR: Could not open JSON file '" << path << "'.\n";
+		return false;
+	}
+	std::string text;
+	char chunk[1 << 16];
+	size_t got;
+	while ((got = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+		text.append(chunk, got);
+	std::fclose(file);
+
+	json_parser parser;
+	if (!parser.parse(text.data(), text.size(), result)) {
+		std::cerr << "ERROR: " << path << ", " << parser.error << ".\n";
+		return false;
+	}
+	return true;
+}
+
+// s as a quoted JSON string, for writing JSON
+inline std::string json_quote(const std::string& s) {
+	std::string quoted = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20) {
+			char escape[8];
+			std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+			quoted += escape;
+		}
+		else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+// x as a JSON number, null for NaN and infinities, which JSON has no syntax for
+inline std::string json_number(double x) {
+	if (!std::isfinite(x))
+		return "null";
+	char number[32];
+	std::snprintf(number, sizeof(number), "%.9g", x);
+	return number;
+}
+
+#endif // !JSON_H
@@ -6,6 +6,9 @@
 
 struct hit_record;
 
+// The materials compiled_scene shades without virtual calls
+enum class material_kind { other, lambertian, metal, dielectric, diffuse_light, isotropic };
+
 double schlick(double cosine, double ref_idx) {
 	auto r0 = (1 - ref_idx) / (1 + ref_idx);
 	r0 = r0 * r0;
@@ -21,6 +24,28 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const = 0;
+
+	// Density with which scatter() picks the direction of scattered. For the
+	// diffuse materials, attenuation * scattering_pdf is the BRDF times the
+	// cosine term, which is what light sampling needs. Specular materials
+	// return 0 and are skipped by light sampling.
+	virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+		return 0;
+	}
+
+	virtual bool is_emissive() const {
+		return false;
+	}
+
+	// Whether emitted or scatter read the u and v of the hit record
+	virtual bool uses_uv() const {
+		return false;
+	}
+
+	// Concrete type for compiled_scene, other if it doesn't know it
+	virtual material_kind kind() const {
+		return material_kind::other;
+	}
 };
 
 class lambertian : public material {
@@ -31,6 +56,13 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
+		scattered = sample(r_in, rec);
+		attenuation = albedo->value(rec.u, rec.v, rec.p);
+		return true;
+	}
+
+	// The scattered ray of scatter, without looking up the albedo
+	static ray sample(const ray& r_in, const hit_record& rec) {
 		//point3 target;
 		//target = rec.p + rec.normal + random_unit_vector();
 		//target = rec.p + rec.normal + random_in_unit_sphere();
@@ -41,9 +73,21 @@ public:
 		if (scatter_direction.near_zero())
 			scatter_direction = rec.normal;
 
-		scattered = ray(rec.p, scatter_direction, r_in.time());
-		attenuation = albedo->value(rec.u, rec.v, rec.p);
-		return true;
+		return ray(rec.spawn_origin(scatter_direction), scatter_direction, r_in.time());
+	}
+
+	// normal + random_unit_vector() is cosine distributed around the normal
+	virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+		auto cosine = dot(rec.normal, unit_vector(scattered.direction()));
+		return cosine < 0 ? 0 : cosine / pi;
+	}
+
+	virtual bool uses_uv() const override {
+		return albedo->uses_uv();
+	}
+
+	virtual material_kind kind() const override {
+		return material_kind::lambertian;
 	}
 
 public:
@@ -58,11 +102,16 @@ public:
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
+		vec3 direction = reflected + fuzz * random_in_unit_sphere();
+		scattered = ray(rec.spawn_origin(direction), direction, r_in.time());
 		attenuation = albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 
+	virtual material_kind kind() const override {
+		return material_kind::metal;
+	}
+
 public:
 	color albedo;
 	double fuzz;
@@ -84,20 +133,24 @@ public:
 		double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 		if (etai_over_etat * sin_theta > 1.0) {
 			vec3 reflected = reflect(unit_direction, rec.normal);
-			scattered = ray(rec.p, reflected);
+			scattered = ray(rec.spawn_origin(reflected), reflected);
 			return true;
 		}
 		double reflect_prob = schlick(cos_theta, etai_over_etat);
 		if (random_double() < reflect_prob) {
 			vec3 reflected = reflect(unit_direction, rec.normal);
-			scattered = ray(rec.p, reflected);
+			scattered = ray(rec.spawn_origin(reflected), reflected);
 			return true;
 		}
 		vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-		scattered = ray(rec.p, refracted, r_in.time());
+		scattered = ray(rec.spawn_origin(refracted), refracted, r_in.time());
 		return true;
 	}
 
+	virtual material_kind kind() const override {
+		return material_kind::dielectric;
+	}
+
 	double ref_idx;
 };
 
@@ -116,6 +169,18 @@ public:
 		return emit->value(u, v, p);
 	}
 
+	virtual bool is_emissive() const override {
+		return true;
+	}
+
+	virtual bool uses_uv() const override {
+		return emit->uses_uv();
+	}
+
+	virtual material_kind kind() const override {
+		return material_kind::diffuse_light;
+	}
+
 public:
 	shared_ptr<texture> emit;
 };
@@ -128,11 +193,30 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const override {
-		scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
+		scattered = sample(r_in, rec);
 		attenuation = albedo->value(rec.u, rec.v, rec.p);
 		return true;
 	}
 
+	// The scattered ray of scatter, without looking up the albedo
+	static ray sample(const ray& r_in, const hit_record& rec) {
+		vec3 direction = random_in_unit_sphere();
+		return ray(rec.spawn_origin(direction), direction, r_in.time());
+	}
+
+	// Uniform over all directions
+	virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+		return 1 / (4 * pi);
+	}
+
+	virtual bool uses_uv() const override {
+		return albedo->uses_uv();
+	}
+
+	virtual material_kind kind() const override {
+		return material_kind::isotropic;
+	}
+
 public:
 	shared_ptr<texture> albedo;
 };
@@ -4,6 +4,7 @@
 #include "aabb.h"
 #include "rtcommon.h"
 #include "hittable.h"
+#include "sphere.h"
 
 class moving_sphere : public hittable {
 public:
@@ -14,17 +15,22 @@ public:
 	{}
 
 	virtual bool hit(
-		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual void surface(const ray& r, hit_record& rec) const override;
 
 	virtual bool bounding_box(
 		double _time0, double _time1, aabb& output_box) const override;
 
+	virtual hittable_kind kind() const override {
+		return hittable_kind::moving_sphere;
+	}
+
 	point3 center(double time) const;
 
 public:
 	point3 center0, center1;
 	double time0, time1;
-	double radius;
+	real radius;
 	shared_ptr<material> mat_ptr;
 };
 
@@ -32,25 +38,20 @@ point3 moving_sphere::center(double time) const {
 	return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
 }
 
-bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool moving_sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
-	vec3 oc = r.origin() - center(r.time());
-	auto a = r.direction().length_squared();
-	auto half_b = dot(oc, r.direction());
-	auto c = oc.length_squared() - radius * radius;
-
-	auto discriminant = half_b * half_b - a * c;
-	if (discriminant < 0)
+	point3 current_center = center(r.time());
+	real near_root, far_root;
+	if (!sphere_roots(r, current_center, radius, near_root, far_root))
 	{
 		return false;
 	}
-	auto sqrtd = sqrt(discriminant);
 
 	// Nearest root in the acceptable range
-	auto root = (-half_b - sqrtd) / a;
+	auto root = near_root;
 	if (t_max < root || root < t_min)
 	{
-		root = (-half_b + sqrtd) / a;
+		root = far_root;
 		if (t_max < root || root < t_min )
 		{
 			return false;
@@ -58,14 +59,23 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
 	}
 
 	rec.t = root;
-	rec.p = r.at(rec.t);
-	auto outward_normal = (rec.p - center(r.time())) / radius;
-	rec.set_face_normal(r, outward_normal);
-	rec.mat_ptr = mat_ptr;
-
+	rec.pending = this;
 	return true;
 }
 
+void moving_sphere::surface(const ray& r, hit_record& rec) const {
+	point3 current_center = center(r.time());
+	rec.p = project_to_sphere(r.at(rec.t), current_center, radius);
+	auto outward_normal = (rec.p - current_center) / radius;
+	rec.set_face_normal(r, outward_normal);
+	if (!rec.mat_ptr)
+		rec.mat_ptr = mat_ptr.get();
+	if (rec.mat_ptr->uses_uv())
+		sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+	else
+		rec.u = rec.v = 0;
+}
+
 bool moving_sphere::bounding_box(double _time0, double _time1, aabb& output_box) const {
 	aabb box0(
 		center(_time0) - vec3(radius, radius, radius),
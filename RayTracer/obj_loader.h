@@ -0,0 +1,312 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "scene_cache.h"
+#include "triangle_mesh.h"
+
+// Parses a decimal number at s and moves s past it. Numbers with at most 19
+// significant digits and a power of ten up to 1e22 are converted with a single
+// multiplication or division of exact doubles, which rounds correctly; OBJ
+// files rarely have anything else, and the rest goes to strtod.
+inline double obj_parse_double(const char*& s) {
+	static const double powers_of_ten[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	const char* start = s;
+	bool negative = false;
+	if (*s == '-' || *s == '+')
+		negative = *s++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	for (; *s >= '0' && *s <= '9'; s++, digits++)
+		mantissa = mantissa * 10 + (*s - '0');
+	if (*s == '.') {
+		for (s++; *s >= '0' && *s <= '9'; s++, digits++, exponent--)
+			mantissa = mantissa * 10 + (*s - '0');
+	}
+	if (*s == 'e' || *s == 'E') {
+		s++;
+		bool negative_exponent = false;
+		if (*s == '-' || *s == '+')
+			negative_exponent = *s++ == '-';
+		int e = 0;
+		for (; *s >= '0' && *s <= '9'; s++)
+			e = std::min(e * 10 + (*s - '0'), 10000);
+		exponent += negative_exponent ? -e : e;
+	}
+
+	if (digits > 19 || mantissa >= (1ull << 53) || exponent < -22 || exponent > 22) {
+		char* end;
+		double value = std::strtod(start, &end);
+		s = end;
+		return value;
+	}
+
+	double value = static_cast<double>(mantissa);
+	value = exponent < 0 ? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+	return negative ? -value : value;
+}
+
+inline int obj_parse_int(const char*& s) {
+	bool negative = false;
+	if (*s == '-' || *s == '+')
+		negative = *s++ == '-';
+	int value = 0;
+	for (; *s >= '0' && *s <= '9'; s++)
+		value = value * 10 + (*s - '0');
+	return negative ? -value : value;
+}
+
+inline void obj_skip_spaces(const char*& s) {
+	while (*s == ' ' || *s == '\t')
+		s++;
+}
+
+// Streams a Wavefront OBJ file into the buffers of mesh. The file is read in
+// fixed-size chunks and parsed in place, so loading needs no per-line strings
+// and no per-triangle objects. Supports v, vt, vn and f with any of the v,
+// v/vt, v//vn and v/vt/vn forms, negative indices and polygons (split into
+// fans). Everything else, including materials and groups, is ignored.
+inline bool parse_obj(const char* filename, triangle_mesh& mesh) {
+	std::FILE* file = std::fopen(filename, "rb");
+	if (!file) {
+		std::cerr << "ERROR: Could not load OBJ file '" << filename << "'.\n";
+		return false;
+	}
+
+	// Attributes as listed in the file. Mesh vertices are made from the
+	// distinct v/vt/vn combinations the faces use.
+	std::vector<point3> file_positions;
+	std::vector<real> file_uvs;
+	std::vector<vec3> file_normals;
+
+	// Corners with only a position map straight to a vertex per position,
+	// the others go through a hash of all three indices
+	std::vector<int> position_vertex;
+	struct corner_hash {
+		size_t operator () (const std::pair<uint64_t, uint64_t>& key) const {
+			return std::hash<uint64_t>()(key.first * 0x9E3779B97F4A7C15ull ^ key.second);
+		}
+	};
+	std::unordered_map<std::pair<uint64_t, uint64_t>, int, corner_hash> corner_vertex;
+	bool has_uvs = false, has_normals = false;
+
+	auto vertex_for = [&](int p, int t, int n) {
+		if (t < 0 && n < 0) {
+			if (position_vertex[p] < 0) {
+				position_vertex[p] = static_cast<int>(mesh.positions.size());
+				mesh.positions.push_back(file_positions[p]);
+				mesh.uvs.push_back(0);
+				mesh.uvs.push_back(0);
+				mesh.normals.push_back(vec3(0, 0, 0));
+			}
+			return position_vertex[p];
+		}
+
+		// Missing indices are -1, which become all ones as unsigned values
+		auto key = std::make_pair(static_cast<uint64_t>(p),
+			(static_cast<uint64_t>(static_cast<uint32_t>(t)) << 32) | static_cast<uint32_t>(n));
+		auto found = corner_vertex.find(key);
+		if (found != corner_vertex.end())
+			return found->second;
+
+		int index = static_cast<int>(mesh.positions.size());
+		corner_vertex.emplace(key, index);
+		mesh.positions.push_back(file_positions[p]);
+		mesh.uvs.push_back(t >= 0 ? file_uvs[2 * t] : 0);
+		mesh.uvs.push_back(t >= 0 ? file_uvs[2 * t + 1] : 0);
+		mesh.normals.push_back(n >= 0 ? file_normals[n] : vec3(0, 0, 0));
+		has_uvs = has_uvs || t >= 0;
+		has_normals = has_normals || n >= 0;
+		return index;
+	};
+
+	long long line_number = 0;
+	int bad_faces = 0;
+	// Position, uv and normal index of each corner of the current face
+	struct corner {
+		int p, t, n;
+	};
+	std::vector<corner> face;
+
+	// Resolves a 1-based or negative OBJ index, -1 if it is out of range
+	auto resolve = [](int index, size_t count) {
+		int resolved = index < 0 ? static_cast<int>(count) + index : index - 1;
+		return resolved >= 0 && resolved < static_cast<int>(count) ? resolved : -1;
+	};
+
+	auto parse_line = [&](const char* s) {
+		line_number++;
+		obj_skip_spaces(s);
+
+		if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+			s++;
+			point3 p;
+			for (int a = 0; a < 3; a++) {
+				obj_skip_spaces(s);
+				p[a] = static_cast<real>(obj_parse_double(s));
+			}
+			file_positions.push_back(p);
+			position_vertex.push_back(-1);
+		}
+		else if (s[0] == 'v' && s[1] == 't') {
+			s += 2;
+			for (int a = 0; a < 2; a++) {
+				obj_skip_spaces(s);
+				file_uvs.push_back(static_cast<real>(obj_parse_double(s)));
+			}
+		}
+		else if (s[0] == 'v' && s[1] == 'n') {
+			s += 2;
+			vec3 n;
+			for (int a = 0; a < 3; a++) {
+				obj_skip_spaces(s);
+				n[a] = static_cast<real>(obj_parse_double(s));
+			}
+			file_normals.push_back(n);
+		}
+		else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+			s++;
+			face.clear();
+			bool valid = true;
+			while (true) {
+				obj_skip_spaces(s);
+				if (!(*s == '-' || (*s >= '0' && *s <= '9')))
+					break;
+
+				int p = resolve(obj_parse_int(s), file_positions.size());
+				int t = -1, n = -1;
+				if (*s == '/') {
+					s++;
+					if (*s != '/')
+						t = resolve(obj_parse_int(s), file_uvs.size() / 2);
+					if (*s == '/') {
+						s++;
+						n = resolve(obj_parse_int(s), file_normals.size());
+					}
+				}
+				if (p < 0) {
+					valid = false;
+					continue;
+				}
+				face.push_back({ p, t, n });
+			}
+
+			// Vertices are only made for faces that are kept
+			if (!valid || face.size() < 3) {
+				bad_faces++;
+				return;
+			}
+			int first = vertex_for(face[0].p, face[0].t, face[0].n);
+			int previous = vertex_for(face[1].p, face[1].t, face[1].n);
+			for (size_t k = 2; k < face.size(); k++) {
+				int current = vertex_for(face[k].p, face[k].t, face[k].n);
+				mesh.indices.push_back(first);
+				mesh.indices.push_back(previous);
+				mesh.indices.push_back(current);
+				previous = current;
+			}
+		}
+	};
+
+	// Complete lines are parsed from the buffer, a partial one at the end is
+	// moved to the front before the next chunk is read behind it
+	const size_t chunk_size = 1 << 20;
+	std::vector<char> buffer(chunk_size + 1);
+	size_t filled = 0;
+	long long bytes_read = 0;
+	while (true) {
+		if (buffer.size() - filled < chunk_size + 1)
+			buffer.resize(filled + chunk_size + 1);
+		size_t got = std::fread(buffer.data() + filled, 1, chunk_size, file);
+		bytes_read += got;
+		filled += got;
+		bool at_end = got == 0;
+
+		size_t line_start = 0;
+		for (size_t i = 0; i < filled; i++) {
+			if (buffer[i] != '\n')
+				continue;
+			buffer[i] = '\0';
+			parse_line(buffer.data() + line_start);
+			line_start = i + 1;
+		}
+
+		if (at_end) {
+			if (line_start < filled) {
+				buffer[filled] = '\0';
+				parse_line(buffer.data() + line_start);
+			}
+			break;
+		}
+
+		filled -= line_start;
+		std::memmove(buffer.data(), buffer.data() + line_start, filled);
+	}
+	std::fclose(file);
+
+	if (!has_uvs)
+		std::vector<real>().swap(mesh.uvs);
+	if (!has_normals)
+		std::vector<vec3>().swap(mesh.normals);
+	mesh.positions.shrink_to_fit();
+	mesh.indices.shrink_to_fit();
+
+	if (bad_faces > 0)
+		std::cerr << "WARNING: Skipped " << bad_faces << " invalid faces in OBJ file '" << filename << "'.\n";
+	std::cout << "Parsed '" << filename << "': " << line_number << " lines, "
+		<< bytes_read / (1024.0 * 1024.0) << " MB\n";
+	return true;
+}
+
+// Loads an OBJ file as a built triangle_mesh whose triangles all use m. The
+// built mesh is kept in a scene cache next to the file; while the file stays
+// the same, later loads just map the cache.
+inline shared_ptr<triangle_mesh> load_obj(const char* filename, shared_ptr<material> m,
+	const bvh_build_options& options = triangle_mesh::leaf_options()) {
+	auto start = std::chrono::high_resolution_clock::now();
+	auto mesh = make_shared<triangle_mesh>(m);
+	auto elapsed_ms = [&]() {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	std::string cache_path = scene_cache_path(filename);
+	uint64_t key = scene_cache_enabled() ? scene_cache_key(filename) : 0;
+	if (key != 0) {
+		key = triangle_mesh::cache_key(key, options);
+		if (mesh->load_cache(cache_path, key)) {
+			std::cout << "Mapped '" << cache_path << "': " << mesh->triangle_count() << " triangles, "
+				<< mesh->vertex_count() << " vertices in " << elapsed_ms() << " ms\n";
+			return mesh;
+		}
+	}
+
+	if (!parse_obj(filename, *mesh))
+		return mesh;
+	double parse_ms = elapsed_ms();
+	mesh->build(options);
+
+	std::cout << "Loaded '" << filename << "': " << mesh->triangle_count() << " triangles, "
+		<< mesh->vertex_count() << " vertices, parsed in " << parse_ms << " ms, BVH built in "
+		<< elapsed_ms() - parse_ms << " ms\n";
+
+	if (key != 0 && !mesh->write_cache(cache_path, key))
+		std::cerr << "WARNING: Could not write scene cache '" << cache_path << "'.\n";
+
+	return mesh;
+}
+
+#endif // !OBJ_LOADER_H
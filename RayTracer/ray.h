@@ -8,22 +8,32 @@
 class ray {
 public:
 	ray() {}
-	ray(const point3& origin, const vec3& direction, double time = 0.0)
+	ray(const point3& origin, const vec3& direction, real time = 0.0)
 		: orig(origin), dir(direction), tm(time)
-	{}
+	{
+		// Box tests multiply by the reciprocal instead of dividing. A zero
+		// component gives +-inf, which the slab test handles.
+		inv_dir = vec3(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+		sign[0] = inv_dir.x() < 0;
+		sign[1] = inv_dir.y() < 0;
+		sign[2] = inv_dir.z() < 0;
+	}
 
 	point3 origin() const { return orig; }
 	vec3 direction() const { return dir; }
-	double time() const { return tm; }
+	vec3 inv_direction() const { return inv_dir; }
+	real time() const { return tm; }
 
-	point3 at(double t) const {
+	point3 at(real t) const {
 		return orig + t * dir;
 	}
 
 public:
 	point3 orig;
 	vec3 dir;
-	double tm;
+	real tm;
+	vec3 inv_dir;
+	int sign[3];	// 1 where the direction is negative, selects the near and far slab planes
 };
 
 #endif
\ No newline at end of file
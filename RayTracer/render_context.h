@@ -0,0 +1,43 @@
+#ifndef RENDER_CONTEXT_H
+#define RENDER_CONTEXT_H
+
+#include "rtcommon.h"
+
+#include "camera.h"
+#include "compiled_scene.h"
+#include "hittable_list.h"
+#include "integrator.h"
+
+// Everything a render task needs to know about the frame. It is filled in once
+// before rendering starts and then only read, so all tasks share one instance
+// by const reference instead of copying the scene or touching refcounts.
+struct render_context {
+	render_context(const hittable_list& objects, const camera& view)
+		: world(objects), cam(view) {}
+
+	hittable_list world;
+	hittable_list lights;	// emissive objects, sampled directly by the nee integrator
+	const compiled_scene* compiled = nullptr;	// world in compiled form, used by the iterative integrators if set
+	camera cam;
+	color background;
+
+	int image_width;
+	int image_height;
+	int samples_per_pixel;
+	int max_depth;
+	uint64_t seed;
+
+	integrator_type integrator = integrator_type::iterative;
+	int roulette_depth = 3;	// bounces before Russian roulette kicks in
+
+	// Intersect the camera rays of 2x2 pixel blocks as one ray packet
+	bool packet_tracing = false;
+
+	// Adaptive sampling: once a pixel has min_samples, it only gets more while
+	// its relative error is above adaptive_threshold
+	bool adaptive_sampling = false;
+	int min_samples = 0;
+	double adaptive_threshold = 0;
+};
+
+#endif // !RENDER_CONTEXT_H
@@ -0,0 +1,193 @@
+#ifndef RENDER_OPTIONS_H
+#define RENDER_OPTIONS_H
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "rtcommon.h"
+
+#include "scene.h"
+
+// Exit codes of the renderer
+const int exit_ok = 0;
+const int exit_scene_error = 1;		// the scene could not be loaded
+const int exit_usage_error = 2;		// invalid command line
+const int exit_output_error = 3;	// the image could not be written
+
+// Command line settings. Everything left at its default keeps what the scene
+// asks for; see print_usage for the flags.
+struct render_options {
+	std::string scene;		// compiled-in scene name or JSON scene file
+	int width = 0;
+	int height = 0;			// derived from width and the scene's aspect ratio if 0
+	int samples_per_pixel = 0;
+	int max_depth = 0;
+	int threads = 0;		// 0 picks from the number of cores
+	bool has_seed = false;
+	uint64_t seed = 0;
+	double time_budget = -1;	// seconds, 0 for no limit
+	std::string output = "final.ppm";
+	std::string summary;		// file for the JSON summary, stdout only if empty
+	std::string timings;		// tile timings CSV
+	bool headless = false;
+	bool use_cache = true;
+	std::string dispatch;		// "switch" or "virtual" overrides the scene's static_dispatch
+	bool help = false;
+};
+
+inline void print_usage(std::ostream& out) {
+	out << "Usage: RayTracer [options] [scene]\n"
+		<< "  --scene NAME|FILE    compiled-in scene or JSON scene file\n"
+		<< "  --width N            image width in pixels\n"
+		<< "  --height N           image height, otherwise from the scene's aspect ratio\n"
+		<< "  --spp N              maximum samples per pixel\n"
+		<< "  --max-depth N        maximum number of light bounces\n"
+		<< "  --threads N          render threads\n"
+		<< "  --seed N             base seed of the per-pixel random streams\n"
+		<< "  --time-budget S      stop after S seconds, at the earliest after the first pass; 0 for no limit\n"
+		<< "  --output FILE        image file; .png, .bmp, .tga, .jpg, .hdr or PPM otherwise\n"
+		<< "  --summary FILE       also write the JSON summary to FILE\n"
+		<< "  --timings FILE       write per-tile render times as CSV\n"
+		<< "  --no-cache           don't read or write scene caches\n"
+		<< "  --dispatch MODE      switch: render from a compiled scene, virtual: from the objects\n"
+		<< "  --headless           no interactive input; log to stderr, print a JSON summary to stdout and exit\n"
+		<< "  --bench-aabb [N]     benchmark ray/box tests and exit\n"
+		<< "  --bench-dispatch [W [SPP]]\n"
+		<< "                       compare virtual and switch dispatch on every compiled-in scene and exit\n"
+		<< "Compiled-in scenes:";
+	for (const char* name : builtin_scene_names)
+		out << ' ' << name;
+	out << "\nExit codes: 0 success, 1 scene error, 2 invalid arguments, 3 image not written\n";
+}
+
+// False after printing an ERROR if the arguments are invalid
+inline bool parse_render_options(int argc, char* argv[], render_options& options) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		auto value = [&](const char*& out) {
+			if (i + 1 >= argc) {
+				std::cerr << "ERROR: " << arg << " needs a value.\n";
+				return false;
+			}
+			out = argv[++i];
+			return true;
+		};
+		auto text_value = [&](std::string& out) {
+			const char* text;
+			if (!value(text))
+				return false;
+			out = text;
+			return true;
+		};
+		auto number = [&](double min, double& out) {
+			const char* text;
+			if (!value(text))
+				return false;
+			char* end;
+			out = std::strtod(text, &end);
+			if (end == text || *end != '\0' || !(out >= min)) {
+				std::cerr << "ERROR: Invalid value '" << text << "' for " << arg << ".\n";
+				return false;
+			}
+			return true;
+		};
+		auto integer = [&](int min, int& out) {
+			double d;
+			if (!number(min, d))
+				return false;
+			if (d > 1e9 || d != static_cast<int>(d)) {
+				std::cerr << "ERROR: " << arg << " needs a whole number.\n";
+				return false;
+			}
+			out = static_cast<int>(d);
+			return true;
+		};
+
+		bool ok = true;
+		if (arg == "--scene")
+			ok = text_value(options.scene);
+		else if (arg == "--width")
+			ok = integer(1, options.width);
+		else if (arg == "--height")
+			ok = integer(1, options.height);
+		else if (arg == "--spp")
+			ok = integer(1, options.samples_per_pixel);
+		else if (arg == "--max-depth")
+			ok = integer(1, options.max_depth);
+		else if (arg == "--threads")
+			ok = integer(1, options.threads);
+		else if (arg == "--seed") {
+			const char* text;
+			ok = value(text);
+			if (ok) {
+				// strtoull would wrap a leading '-' around and skip spaces
+				char* end;
+				errno = 0;
+				options.seed = std::strtoull(text, &end, 10);
+				options.has_seed = std::isdigit(static_cast<unsigned char>(text[0])) && *end == '\0' && errno != ERANGE;
+				if (!options.has_seed) {
+					std::cerr << "ERROR: Invalid value '" << text << "' for --seed.\n";
+					ok = false;
+				}
+			}
+		}
+		else if (arg == "--time-budget")
+			ok = number(0, options.time_budget);
+		else if (arg == "--output")
+			ok = text_value(options.output);
+		else if (arg == "--summary")
+			ok = text_value(options.summary);
+		else if (arg == "--timings")
+			ok = text_value(options.timings);
+		else if (arg == "--no-cache")
+			options.use_cache = false;
+		else if (arg == "--dispatch") {
+			ok = text_value(options.dispatch);
+			if (ok && options.dispatch != "switch" && options.dispatch != "virtual") {
+				std::cerr << "ERROR: Invalid value '" << options.dispatch << "' for --dispatch.\n";
+				ok = false;
+			}
+		}
+		else if (arg == "--headless")
+			options.headless = true;
+		else if (arg == "--help" || arg == "-h")
+			options.help = true;
+		else if (arg.size() > 1 && arg[0] == '-') {
+			std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+			ok = false;
+		}
+		else if (options.scene.empty())
+			options.scene = arg;
+		else {
+			std::cerr << "ERROR: More than one scene given ('" << options.scene << "' and '" << arg << "').\n";
+			ok = false;
+		}
+
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+// Applies the options that override scene settings
+inline void apply_render_options(const render_options& options, scene& s) {
+	if (options.width > 0)
+		s.image_width = options.width;
+	if (options.samples_per_pixel > 0)
+		s.samples_per_pixel = options.samples_per_pixel;
+	if (options.max_depth > 0)
+		s.max_depth = options.max_depth;
+	if (options.has_seed)
+		s.seed = options.seed;
+	if (options.time_budget >= 0)
+		s.time_budget = options.time_budget;
+	if (!options.dispatch.empty())
+		s.static_dispatch = options.dispatch == "switch";
+}
+
+#endif // !RENDER_OPTIONS_H
@@ -0,0 +1,66 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 random number generator (https://www.pcg-random.org/).
+// Small state, fast, and every (seed, sequence) pair gives an independent stream.
+class pcg32 {
+public:
+	pcg32() { seed(default_state, default_sequence); }
+	pcg32(uint64_t init_state, uint64_t init_sequence = default_sequence) { seed(init_state, init_sequence); }
+
+	void seed(uint64_t init_state, uint64_t init_sequence = default_sequence) {
+		state = 0;
+		inc = (init_sequence << 1u) | 1u;
+		next_uint();
+		state += init_state;
+		next_uint();
+	}
+
+	uint32_t next_uint() {
+		uint64_t old_state = state;
+		state = old_state * multiplier + inc;
+		uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+		uint32_t rot = static_cast<uint32_t>(old_state >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+	}
+
+	// Uniform in [0,1)
+	double next_double() {
+		return next_uint() * (1.0 / 4294967296.0);
+	}
+
+private:
+	static const uint64_t multiplier = 0x5851f42d4c957f2dULL;
+	static const uint64_t default_state = 0x853c49e6748fea9bULL;
+	static const uint64_t default_sequence = 0xda3e39cb94b95bdbULL;
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+// SplitMix64 finalizer, turns structured input (pixel index, pass, ...) into a well mixed seed
+inline uint64_t mix_seed(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// Every thread owns its generator, so sampling never contends on shared state.
+// Threads start from the same default state; anything that has to be
+// reproducible reseeds explicitly with seed_thread_rng.
+inline pcg32& thread_rng() {
+	thread_local pcg32 rng;
+	return rng;
+}
+
+// Seeds the calling thread's generator from a base seed and an index, e.g. the
+// render seed and a pixel index. The result only depends on the two values,
+// not on which thread runs the work or in which order.
+inline void seed_thread_rng(uint64_t seed, uint64_t index) {
+	thread_rng().seed(mix_seed(seed ^ mix_seed(index)), index);
+}
+
+#endif // !RNG_H
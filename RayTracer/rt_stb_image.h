@@ -10,6 +10,9 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb_image.h"
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
+
 // Restore warning levels
 #ifdef _MSC_VER
 	// microsoft compiler
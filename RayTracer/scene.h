@@ -1,17 +1,25 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <string>
+
 #include "rtcommon.h"
 #include "camera.h"
 #include "hittable_list.h"
 #include "texture.h"
 #include "sphere.h"
 #include "material.h"
-#include "bvh.h"
+#include "flat_bvh.h"
 #include "aarect.h"
 #include "box.h"
 #include "moving_sphere.h"
 #include "constant_medium.h"
+#include "integrator.h"
+#include "wide_bvh.h"
+#include "sphere_set.h"
+#include "obj_loader.h"
+#include "instance.h"
+#include "scene_arena.h"
 
 class scene {
 public:
@@ -28,10 +36,28 @@ public:
 		t0 = 0;
 		t1 = 1;
 		background = color(0, 0, 0);
+		seed = 0;
+		tile_size = 16;
+		pass_samples = 8;
+		time_budget = 0;
+		integrator = integrator_type::nee;
+		roulette_depth = 3;
+		packet_tracing = false;
+		static_dispatch = false;
+		adaptive_sampling = false;
+		min_samples = 32;
+		adaptive_threshold = 0.02;
 	}
 
 	virtual void set_custom_image_settings() {};
 
+	// Creates an object in the scene's arena. Copies of the scene share the
+	// arena, which is released along with the last of them.
+	template <typename T, typename... Args>
+	shared_ptr<T> make(Args&&... args) {
+		return arena->make<T>(std::forward<Args>(args)...);
+	}
+
 public:
 	// Image settings.
 	int image_width;
@@ -46,6 +72,42 @@ public:
 	// Background color
 	color background;
 
+	// Base seed of the per-pixel random streams
+	uint64_t seed;
+
+	// Edge length in pixels of the square tiles the image is split into for rendering
+	int tile_size;
+
+	// Samples per pixel of one progressive pass, 0 takes all samples in a single pass
+	int pass_samples;
+
+	// Stop rendering after this many seconds, 0 for no limit
+	double time_budget;
+
+	// Path integrator and the number of bounces before Russian roulette starts
+	// terminating dim paths. nee samples the emissive objects of world directly.
+	integrator_type integrator;
+	int roulette_depth;
+
+	// Intersect the camera rays of 2x2 pixel blocks together, testing the four
+	// rays against each BVH box with the widest SIMD instructions the CPU has.
+	// Only pays off for scenes whose objects sit in a flat_bvh.
+	bool packet_tracing;
+
+	// Render from a compiled_scene, which dispatches to the common primitives,
+	// materials and textures with switches instead of virtual calls. Pays off
+	// for scenes whose objects sit in nested lists, boxes and BVHs, which it
+	// flattens into one tree; --bench-dispatch compares both. Camera ray
+	// packets and the recursive integrator always use the virtual objects.
+	bool static_dispatch;
+
+	// Adaptive sampling: every pixel gets at least min_samples, then only pixels
+	// whose relative error is still above adaptive_threshold keep getting samples,
+	// up to samples_per_pixel. Convergence is checked between progressive passes.
+	bool adaptive_sampling;
+	int min_samples;
+	double adaptive_threshold;
+
 	// Camera location
 	point3 lookfrom;
 
@@ -68,6 +130,9 @@ public:
 	double t0;
 	double t1;
 
+	// Owns the objects made with make()
+	shared_ptr<scene_arena> arena = make_shared<scene_arena>();
+
 	// Objects in this scene.
 	hittable_list world;
 };
@@ -78,15 +143,15 @@ public:
 	{
 		hittable_list objects;
 
-		auto avamat = make_shared<lambertian>(make_shared<image_texture>("../resources/untiLARGE.png"));
-		auto avasphere = make_shared<sphere>(point3(0, 0, 3.73), 1.8, avamat);
-		objects.add(make_shared<rotate_y>(avasphere, 0));
+		auto avamat = make<lambertian>(make<image_texture>("../resources/untiLARGE.png"));
+		auto avasphere = make<sphere>(point3(0, 0, 3.73), 1.8, avamat);
+		objects.add(make<rotate_y>(avasphere, 0));
 
-		auto earthmat = make_shared<lambertian>(make_shared<image_texture>("../resources/earthmap.jpg"));
-		objects.add(make_shared<sphere>(point3(1.88, .4, 1.61), .18, earthmat));
+		auto earthmat = make<lambertian>(make<image_texture>("../resources/earthmap.jpg"));
+		objects.add(make<sphere>(point3(1.88, .4, 1.61), .18, earthmat));
 
-		auto light = make_shared<diffuse_light>(color(1.2, 1.2, .8));
-		objects.add(make_shared<xy_rect>(-20, 100, -40, 100, -20, light));
+		auto light = make<diffuse_light>(color(1.2, 1.2, .8));
+		objects.add(make<xy_rect>(-20, 100, -40, 100, -20, light));
 
 		world = objects;
 
@@ -112,20 +177,20 @@ public:
 	{
 		hittable_list objects;
 
-		auto avamat = make_shared<lambertian>(make_shared<image_texture>("../resources/untiLARGE.png"));
-		auto avasphere = make_shared<sphere>(point3(0, 0, 3.73), 1.8, avamat);
-		objects.add(make_shared<rotate_y>(avasphere, 0));
+		auto avamat = make<lambertian>(make<image_texture>("../resources/untiLARGE.png"));
+		auto avasphere = make<sphere>(point3(0, 0, 3.73), 1.8, avamat);
+		objects.add(make<rotate_y>(avasphere, 0));
 
-		auto earthmat = make_shared<lambertian>(make_shared<image_texture>("../resources/earthmap.jpg"));
-		objects.add(make_shared<sphere>(point3(1.88, .4, 1.61), .18, earthmat));
+		auto earthmat = make<lambertian>(make<image_texture>("../resources/earthmap.jpg"));
+		objects.add(make<sphere>(point3(1.88, .4, 1.61), .18, earthmat));
 
-		auto light = make_shared<diffuse_light>(color(1.5, 1.5, 1));
-		objects.add(make_shared<xy_rect>(-20, 100, -40, 100, -20, light));
+		auto light = make<diffuse_light>(color(1.5, 1.5, 1));
+		objects.add(make<xy_rect>(-20, 100, -40, 100, -20, light));
 
 		// "from us forward" z increases from us
 		// "right to left" x increases to left
 		// Boxes under the scene
-		auto ground = make_shared<lambertian>(color(0.0, 0.0, 60.0 / 255.0));
+		auto ground = make<lambertian>(color(0.0, 0.0, 60.0 / 255.0));
 
 		hittable_list boxes1;
 		hittable_list boxes2;
@@ -133,41 +198,41 @@ public:
 		hittable_list boxes4;
 		hittable_list boxes5;
 
-		boxes1.add(make_shared<box>(point3(-5, -6.25, 4), point3(-3, -4.25, 6), ground));
-		boxes1.add(make_shared<box>(point3(-3, -6.5, 4), point3(-1, -4.5, 6), ground));
-		boxes1.add(make_shared<box>(point3(-1, -6, 4), point3(1, -4, 6), ground));
-		boxes1.add(make_shared<box>(point3(1, -6.4, 4), point3(3, -4.4, 6), ground));
-		boxes1.add(make_shared<box>(point3(3, -6.1, 4), point3(5, -4.1, 6), ground));
-
-		boxes2.add(make_shared<box>(point3(-5, -6.1, 2), point3(-3, -4.1, 4), ground));
-		boxes2.add(make_shared<box>(point3(-3, -6, 2), point3(-1, -4, 4), ground));
-		boxes2.add(make_shared<box>(point3(-1, -6.2, 2), point3(1, -4.2, 4), ground));
-		boxes2.add(make_shared<box>(point3(1, -6.45, 2), point3(3, -4.45, 4), ground));
-		boxes2.add(make_shared<box>(point3(3, -6.32, 2), point3(5, -4.32, 4), ground));
-
-		boxes3.add(make_shared<box>(point3(-5, -6.26, 0), point3(-3, -4.26, 2), ground));
-		boxes3.add(make_shared<box>(point3(-3, -6.35, 0), point3(-1, -4.35, 2), ground));
-		boxes3.add(make_shared<box>(point3(-1, -6.1, 0), point3(1, -4.1, 2), ground));
-		boxes3.add(make_shared<box>(point3(1, -6.5, 0), point3(3, -4.5, 2), ground));
-		boxes3.add(make_shared<box>(point3(3, -6.21, 0), point3(5, -4.21, 2), ground));
-
-		boxes4.add(make_shared<box>(point3(-5, -6.3, 6), point3(-3, -4.3, 8), ground));
-		boxes4.add(make_shared<box>(point3(-3, -6.35, 6), point3(-1, -4.35, 8), ground));
-		boxes4.add(make_shared<box>(point3(-1, -6.1, 6), point3(1, -4.1, 8), ground));
-		boxes4.add(make_shared<box>(point3(1, -6.5, 6), point3(3, -4.5, 8), ground));
-		boxes4.add(make_shared<box>(point3(3, -6.21, 6), point3(5, -4.21, 8), ground));
-
-		boxes5.add(make_shared<box>(point3(-5, -6.1, 8), point3(-3, -4.1, 10), ground));
-		boxes5.add(make_shared<box>(point3(-3, -6, 8), point3(-1, -4, 10), ground));
-		boxes5.add(make_shared<box>(point3(-1, -6.2, 8), point3(1, -4.2, 10), ground));
-		boxes5.add(make_shared<box>(point3(1, -6.45, 8), point3(3, -4.45, 10), ground));
-		boxes5.add(make_shared<box>(point3(3, -6.32, 8), point3(5, -4.32, 10), ground));
-
-		objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-		objects.add(make_shared<bvh_node>(boxes2, 0, 1));
-		objects.add(make_shared<bvh_node>(boxes3, 0, 1));
-		objects.add(make_shared<bvh_node>(boxes4, 0, 1));
-		objects.add(make_shared<bvh_node>(boxes5, 0, 1));
+		boxes1.add(make<box>(point3(-5, -6.25, 4), point3(-3, -4.25, 6), ground));
+		boxes1.add(make<box>(point3(-3, -6.5, 4), point3(-1, -4.5, 6), ground));
+		boxes1.add(make<box>(point3(-1, -6, 4), point3(1, -4, 6), ground));
+		boxes1.add(make<box>(point3(1, -6.4, 4), point3(3, -4.4, 6), ground));
+		boxes1.add(make<box>(point3(3, -6.1, 4), point3(5, -4.1, 6), ground));
+
+		boxes2.add(make<box>(point3(-5, -6.1, 2), point3(-3, -4.1, 4), ground));
+		boxes2.add(make<box>(point3(-3, -6, 2), point3(-1, -4, 4), ground));
+		boxes2.add(make<box>(point3(-1, -6.2, 2), point3(1, -4.2, 4), ground));
+		boxes2.add(make<box>(point3(1, -6.45, 2), point3(3, -4.45, 4), ground));
+		boxes2.add(make<box>(point3(3, -6.32, 2), point3(5, -4.32, 4), ground));
+
+		boxes3.add(make<box>(point3(-5, -6.26, 0), point3(-3, -4.26, 2), ground));
+		boxes3.add(make<box>(point3(-3, -6.35, 0), point3(-1, -4.35, 2), ground));
+		boxes3.add(make<box>(point3(-1, -6.1, 0), point3(1, -4.1, 2), ground));
+		boxes3.add(make<box>(point3(1, -6.5, 0), point3(3, -4.5, 2), ground));
+		boxes3.add(make<box>(point3(3, -6.21, 0), point3(5, -4.21, 2), ground));
+
+		boxes4.add(make<box>(point3(-5, -6.3, 6), point3(-3, -4.3, 8), ground));
+		boxes4.add(make<box>(point3(-3, -6.35, 6), point3(-1, -4.35, 8), ground));
+		boxes4.add(make<box>(point3(-1, -6.1, 6), point3(1, -4.1, 8), ground));
+		boxes4.add(make<box>(point3(1, -6.5, 6), point3(3, -4.5, 8), ground));
+		boxes4.add(make<box>(point3(3, -6.21, 6), point3(5, -4.21, 8), ground));
+
+		boxes5.add(make<box>(point3(-5, -6.1, 8), point3(-3, -4.1, 10), ground));
+		boxes5.add(make<box>(point3(-3, -6, 8), point3(-1, -4, 10), ground));
+		boxes5.add(make<box>(point3(-1, -6.2, 8), point3(1, -4.2, 10), ground));
+		boxes5.add(make<box>(point3(1, -6.45, 8), point3(3, -4.45, 10), ground));
+		boxes5.add(make<box>(point3(3, -6.32, 8), point3(5, -4.32, 10), ground));
+
+		objects.add(make<flat_bvh>(boxes1, 0, 1));
+		objects.add(make<flat_bvh>(boxes2, 0, 1));
+		objects.add(make<flat_bvh>(boxes3, 0, 1));
+		objects.add(make<flat_bvh>(boxes4, 0, 1));
+		objects.add(make<flat_bvh>(boxes5, 0, 1));
 
 		world = objects;
 
@@ -181,6 +246,8 @@ public:
 		samples_per_pixel = 50;
 		max_depth = 20;
 		background = color(0.0235, .0078, .0);
+		packet_tracing = true;
+		static_dispatch = true;
 		lookfrom = point3(2.46, 1.61, -3.98);
 		lookat = point3(0, 0, 3.73);
 		vfov = 60.0;
@@ -190,9 +257,9 @@ public:
 class earth_scene : public scene {
 public:
 	earth_scene() {
-		auto earth_texture = make_shared<image_texture>("../resources/earthmap.jpg");
-		auto earth_surface = make_shared<lambertian>(earth_texture);
-		auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+		auto earth_texture = make<image_texture>("../resources/earthmap.jpg");
+		auto earth_surface = make<lambertian>(earth_texture);
+		auto globe = make<sphere>(point3(0, 0, 0), 2, earth_surface);
 
 		world = hittable_list(globe);
 
@@ -213,9 +280,9 @@ public:
 	two_perlin_spheres_scene() {
 		hittable_list objects;
 
-		auto pertext = make_shared<noise_texture>(5);
-		objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-		objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+		auto pertext = make<noise_texture>(5);
+		objects.add(make<sphere>(point3(0, -1000, 0), 1000, make<lambertian>(pertext)));
+		objects.add(make<sphere>(point3(0, 2, 0), 2, make<lambertian>(pertext)));
 
 		world = objects;
 
@@ -236,10 +303,10 @@ public:
 	random_scene() {
 		hittable_list objects;
 
-		auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-		objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+		auto checker = make<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+		objects.add(make<sphere>(point3(0, -1000, 0), 1000, make<lambertian>(checker)));
 
-		hittable_list smaller_spheres;
+		auto smaller_spheres = make<sphere_set>();
 
 		for (int a = -11; a < 11; a++) {
 			for (int b = -11; b < 11; b++) {
@@ -252,35 +319,36 @@ public:
 					if (choose_mat < 0.8) {
 						// diffuse
 						auto albedo = color::random() * color::random();
-						sphere_material = make_shared<lambertian>(albedo);
-						smaller_spheres.add(make_shared<sphere>(center, 0.2, sphere_material));
+						sphere_material = make<lambertian>(albedo);
+						smaller_spheres->add(center, 0.2, sphere_material);
 					}
 					else if (choose_mat < 0.95) {
 						// metal
 						auto albedo = color::random(0.5, 1);
 						auto fuzz = random_double(0, 0.5);
-						sphere_material = make_shared<metal>(albedo, fuzz);
-						smaller_spheres.add(make_shared<sphere>(center, 0.2, sphere_material));
+						sphere_material = make<metal>(albedo, fuzz);
+						smaller_spheres->add(center, 0.2, sphere_material);
 					}
 					else {
 						// glass
-						sphere_material = make_shared<dielectric>(1.5);
-						smaller_spheres.add(make_shared<sphere>(center, 0.2, sphere_material));
+						sphere_material = make<dielectric>(1.5);
+						smaller_spheres->add(center, 0.2, sphere_material);
 					}
 				}
 			}
 		}
 
-		objects.add(make_shared<bvh_node>(smaller_spheres, 0.0, 1.0));
+		smaller_spheres->build();
+		objects.add(smaller_spheres);
 
-		auto material1 = make_shared<dielectric>(1.5);
-		objects.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+		auto material1 = make<dielectric>(1.5);
+		objects.add(make<sphere>(point3(0, 1, 0), 1.0, material1));
 
-		auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-		objects.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+		auto material2 = make<lambertian>(color(0.4, 0.2, 0.1));
+		objects.add(make<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-		auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-		objects.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+		auto material3 = make<metal>(color(0.7, 0.6, 0.5), 0.0);
+		objects.add(make<sphere>(point3(4, 1, 0), 1.0, material3));
 
 		world = objects;
 
@@ -294,6 +362,7 @@ public:
 		max_depth = 20;
 		aspect_ratio = 16.0 / 9.0;
 		background = color(0.70, 0.80, 1.00);
+		packet_tracing = true;
 		lookfrom = point3(13, 2, 3);
 		lookat = point3(0, 0, 0);
 		vfov = 20.0;
@@ -306,14 +375,14 @@ public:
 	simple_light_scene() {
 		hittable_list objects;
 
-		auto pertext = make_shared<noise_texture>(4);
-		objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-		objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+		auto pertext = make<noise_texture>(4);
+		objects.add(make<sphere>(point3(0, -1000, 0), 1000, make<lambertian>(pertext)));
+		objects.add(make<sphere>(point3(0, 2, 0), 2, make<lambertian>(pertext)));
 
-		auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-		objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
+		auto difflight = make<diffuse_light>(color(4, 4, 4));
+		objects.add(make<xy_rect>(3, 5, 1, 3, -2, difflight));
 
-		objects.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
+		objects.add(make<sphere>(point3(0, 7, 0), 2, difflight));
 
 		world = objects;
 
@@ -335,26 +404,26 @@ public:
 	cornell_box_scene() {
 		hittable_list objects;
 
-		auto red = make_shared<lambertian>(color(.65, .05, .05));
-		auto white = make_shared<lambertian>(color(.73, .73, .73));
-		auto green = make_shared<lambertian>(color(.12, .45, .15));
-		auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-		objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-		objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-		objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-		objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-		shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-		box1 = make_shared<rotate_y>(box1, 15);
-		box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+		auto red = make<lambertian>(color(.65, .05, .05));
+		auto white = make<lambertian>(color(.73, .73, .73));
+		auto green = make<lambertian>(color(.12, .45, .15));
+		auto light = make<diffuse_light>(color(15, 15, 15));
+
+		objects.add(make<yz_rect>(0, 555, 0, 555, 555, green));
+		objects.add(make<yz_rect>(0, 555, 0, 555, 0, red));
+		objects.add(make<xz_rect>(213, 343, 227, 332, 554, light));
+		objects.add(make<xz_rect>(0, 555, 0, 555, 0, white));
+		objects.add(make<xz_rect>(0, 555, 0, 555, 555, white));
+		objects.add(make<xy_rect>(0, 555, 0, 555, 555, white));
+
+		shared_ptr<hittable> box1 = make<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+		box1 = make<rotate_y>(box1, 15);
+		box1 = make<translate>(box1, vec3(265, 0, 295));
 		objects.add(box1);
 
-		shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-		box2 = make_shared<rotate_y>(box2, -18);
-		box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+		shared_ptr<hittable> box2 = make<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+		box2 = make<rotate_y>(box2, -18);
+		box2 = make<translate>(box2, vec3(130, 0, 65));
 		objects.add(box2);
 
 		world = objects;
@@ -367,6 +436,48 @@ public:
 		aspect_ratio = 1.0;
 		image_width = 600;
 		samples_per_pixel = 1000;
+		adaptive_sampling = true;
+		static_dispatch = true;
+		background = color(0, 0, 0);
+		lookfrom = point3(278, 278, -800);
+		lookat = point3(278, 278, 0);
+		vfov = 40.0;
+	}
+};
+
+class mesh_scene : public scene {
+public:
+	mesh_scene() {
+		hittable_list objects;
+
+		auto red = make<lambertian>(color(.65, .05, .05));
+		auto white = make<lambertian>(color(.73, .73, .73));
+		auto green = make<lambertian>(color(.12, .45, .15));
+		auto light = make<diffuse_light>(color(15, 15, 15));
+
+		objects.add(make<yz_rect>(0, 555, 0, 555, 555, green));
+		objects.add(make<yz_rect>(0, 555, 0, 555, 0, red));
+		objects.add(make<xz_rect>(213, 343, 227, 332, 554, light));
+		objects.add(make<xz_rect>(0, 555, 0, 555, 0, white));
+		objects.add(make<xz_rect>(0, 555, 0, 555, 555, white));
+		objects.add(make<xy_rect>(0, 555, 0, 555, 555, white));
+
+		auto gold = make<metal>(color(0.83, 0.69, 0.22), 0.15);
+		shared_ptr<hittable> knot = load_obj("../resources/torus_knot.obj", gold);
+		objects.add(make<instance>(knot,
+			affine_transform::translation(vec3(278, 220, 278)) * affine_transform::rotation(vec3(1, 0, 0), -50)));
+
+		world = objects;
+
+		set_image_defaults();
+		set_custom_image_settings();
+	}
+
+	void set_custom_image_settings() override {
+		aspect_ratio = 1.0;
+		image_width = 600;
+		samples_per_pixel = 200;
+		adaptive_sampling = true;
 		background = color(0, 0, 0);
 		lookfrom = point3(278, 278, -800);
 		lookat = point3(278, 278, 0);
@@ -374,33 +485,83 @@ public:
 	}
 };
 
+class instancing_scene : public scene {
+public:
+	instancing_scene() {
+		hittable_list objects;
+
+		auto checker = make<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+		objects.add(make<xz_rect>(-1000, 1000, -1000, 1000, 0, make<lambertian>(checker)));
+
+		// One mesh placed 10000 times, with a few materials swapped in
+		auto knot = load_obj("../resources/torus_knot.obj", make<metal>(color(0.83, 0.69, 0.22), 0.15));
+		shared_ptr<material> materials[] = {
+			nullptr,
+			make<lambertian>(color(0.65, 0.05, 0.05)),
+			make<lambertian>(color(0.12, 0.45, 0.15)),
+			make<dielectric>(1.5)
+		};
+
+		auto knots = make<instance_bvh>();
+		for (int a = -50; a < 50; a++) {
+			for (int b = -50; b < 50; b++) {
+				double scale = random_double(0.006, 0.01);
+				affine_transform to_world =
+					affine_transform::translation(vec3(3 * a + random_double(0, 1.5), 160 * scale, 3 * b + random_double(0, 1.5)))
+					* affine_transform::rotation(vec3::random(-1, 1), random_double(0, 360))
+					* affine_transform::scaling(scale);
+				knots->add(knot, to_world, materials[random_int(0, 3)]);
+			}
+		}
+		knots->build(0, 1);
+		objects.add(knots);
+
+		world = objects;
+
+		set_image_defaults();
+		set_custom_image_settings();
+	}
+
+	void set_custom_image_settings() override {
+		image_width = 800;
+		samples_per_pixel = 100;
+		max_depth = 20;
+		background = color(0.70, 0.80, 1.00);
+		lookfrom = point3(40, 12, 40);
+		lookat = point3(0, 0, 0);
+		vfov = 30.0;
+		aperture = 0;
+		adaptive_sampling = true;
+	}
+};
+
 class cornell_smoke_scene : public scene {
 public:
 	cornell_smoke_scene() {
 		hittable_list objects;
 
-		auto red = make_shared<lambertian>(color(.65, .05, .05));
-		auto white = make_shared<lambertian>(color(.73, .73, .73));
-		auto green = make_shared<lambertian>(color(.12, .45, .15));
-		auto light = make_shared<diffuse_light>(color(7, 7, 7));
+		auto red = make<lambertian>(color(.65, .05, .05));
+		auto white = make<lambertian>(color(.73, .73, .73));
+		auto green = make<lambertian>(color(.12, .45, .15));
+		auto light = make<diffuse_light>(color(7, 7, 7));
 
-		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-		objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-		objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-		objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-		objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+		objects.add(make<yz_rect>(0, 555, 0, 555, 555, green));
+		objects.add(make<yz_rect>(0, 555, 0, 555, 0, red));
+		objects.add(make<xz_rect>(113, 443, 127, 432, 554, light));
+		objects.add(make<xz_rect>(0, 555, 0, 555, 555, white));
+		objects.add(make<xz_rect>(0, 555, 0, 555, 0, white));
+		objects.add(make<xy_rect>(0, 555, 0, 555, 555, white));
 
-		shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-		box1 = make_shared<rotate_y>(box1, 15);
-		box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+		shared_ptr<hittable> box1 = make<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+		box1 = make<rotate_y>(box1, 15);
+		box1 = make<translate>(box1, vec3(265, 0, 295));
 
-		shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-		box2 = make_shared<rotate_y>(box2, -18);
-		box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+		shared_ptr<hittable> box2 = make<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+		box2 = make<rotate_y>(box2, -18);
+		box2 = make<translate>(box2, vec3(130, 0, 65));
 
-		objects.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-		objects.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
+		objects.add(make<constant_medium>(box1, 0.01, color(0, 0, 0)));
+		objects.add(make<constant_medium>(box2, 0.01, color(1, 1, 1)));
 
 		world = objects;
 
@@ -412,6 +573,7 @@ public:
 		aspect_ratio = 1.0;
 		image_width = 600;
 		samples_per_pixel = 200;
+		static_dispatch = true;
 		lookfrom = point3(278, 278, -800);
 		lookat = point3(278, 278, 0);
 		vfov = 40.0;
@@ -422,7 +584,7 @@ class final_scene : public scene {
 public:
 	final_scene() {
 		hittable_list boxes1;
-		auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+		auto ground = make<lambertian>(color(0.48, 0.83, 0.53));
 
 		const int boxes_per_side = 20;
 		for (int i = 0; i < boxes_per_side; i++) {
@@ -435,48 +597,48 @@ public:
 				auto y1 = random_double(1, 101);
 				auto z1 = z0 + w;
 
-				boxes1.add(make_shared<box>(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+				boxes1.add(make<box>(point3(x0, y0, z0), point3(x1, y1, z1), ground));
 			}
 		}
 
 		hittable_list objects;
 
-		objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+		objects.add(make<wide_bvh>(boxes1, 0, 1));
 
-		auto light = make_shared<diffuse_light>(color(7, 7, 7));
-		objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+		auto light = make<diffuse_light>(color(7, 7, 7));
+		objects.add(make<xz_rect>(123, 423, 147, 412, 554, light));
 
 		auto center1 = point3(400, 400, 200);
 		auto center2 = center1 + vec3(30, 0, 0);
-		auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-		objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+		auto moving_sphere_material = make<lambertian>(color(0.7, 0.3, 0.1));
+		objects.add(make<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
 
-		objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-		objects.add(make_shared<sphere>(
-			point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+		objects.add(make<sphere>(point3(260, 150, 45), 50, make<dielectric>(1.5)));
+		objects.add(make<sphere>(
+			point3(0, 150, 145), 50, make<metal>(color(0.8, 0.8, 0.9), 1.0)
 			));
 
-		auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
+		auto boundary = make<sphere>(point3(360, 150, 145), 70, make<dielectric>(1.5));
 		objects.add(boundary);
-		objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-		boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-		objects.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
+		objects.add(make<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+		boundary = make<sphere>(point3(0, 0, 0), 5000, make<dielectric>(1.5));
+		objects.add(make<constant_medium>(boundary, .0001, color(1, 1, 1)));
 
-		auto emat = make_shared<lambertian>(make_shared<image_texture>("../../resources/earthmap.jpg"));
-		objects.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-		auto pertext = make_shared<noise_texture>(0.1);
-		objects.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+		auto emat = make<lambertian>(make<image_texture>("../../resources/earthmap.jpg"));
+		objects.add(make<sphere>(point3(400, 200, 400), 100, emat));
+		auto pertext = make<noise_texture>(0.1);
+		objects.add(make<sphere>(point3(220, 280, 300), 80, make<lambertian>(pertext)));
 
-		hittable_list boxes2;
-		auto white = make_shared<lambertian>(color(.73, .73, .73));
+		auto boxes2 = make<sphere_set>();
+		auto white = make<lambertian>(color(.73, .73, .73));
 		int ns = 1000;
 		for (int j = 0; j < ns; j++) {
-			boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
+			boxes2->add(point3::random(0, 165), 10, white);
 		}
+		boxes2->build();
 
-		objects.add(make_shared<translate>(
-			make_shared<rotate_y>(
-				make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
+		objects.add(make<translate>(
+			make<rotate_y>(boxes2, 15),
 			vec3(-100, 270, 395)
 			)
 		);
@@ -491,6 +653,10 @@ public:
 		aspect_ratio = 1.0;
 		image_width = 600;
 		samples_per_pixel = 5000;
+		adaptive_sampling = true;
+		min_samples = 64;
+		packet_tracing = true;
+		static_dispatch = true;
 		background = color(0, 0, 0);
 		lookfrom = point3(478, 278, -600);
 		lookat = point3(278, 278, 0);
@@ -498,4 +664,28 @@ public:
 	}
 };
 
+// Names of the compiled-in scenes, without the _scene suffix
+const char* const builtin_scene_names[] = {
+	"avatar", "avatar_enhanced", "random", "two_perlin_spheres", "earth", "simple_light",
+	"cornell_box", "cornell_smoke", "mesh", "instancing", "final"
+};
+
+// Sets s to the compiled-in scene called name, e.g. "cornell_box" for
+// cornell_box_scene. Only that scene gets built. False for unknown names.
+inline bool make_builtin_scene(const std::string& name, scene& s) {
+	if (name == "avatar") s = avatar_scene();
+	else if (name == "avatar_enhanced") s = avatar_enhanced_scene();
+	else if (name == "random") s = random_scene();
+	else if (name == "two_perlin_spheres") s = two_perlin_spheres_scene();
+	else if (name == "earth") s = earth_scene();
+	else if (name == "simple_light") s = simple_light_scene();
+	else if (name == "cornell_box") s = cornell_box_scene();
+	else if (name == "cornell_smoke") s = cornell_smoke_scene();
+	else if (name == "mesh") s = mesh_scene();
+	else if (name == "instancing") s = instancing_scene();
+	else if (name == "final") s = final_scene();
+	else return false;
+	return true;
+}
+
 #endif // !SCENE_H
\ No newline at end of file
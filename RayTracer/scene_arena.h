@@ -0,0 +1,91 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rtcommon.h"
+
+// Bump allocator for the objects of one scene. Objects are laid out one after
+// the other in large blocks, in the order the scene creates them, so the
+// primitives, materials and textures a ray visits together tend to share
+// cache lines and pages instead of being scattered over the heap.
+//
+// make() hands out shared_ptrs without a control block: copying them touches
+// no reference count, and they don't keep anything alive. The arena owns all
+// of its objects and destroys them together in release() or its destructor,
+// in reverse order of creation, after which their memory goes back in a few
+// large frees. Every pointer into the arena has to be gone by then, which is
+// the case for anything that lives inside the scene that owns the arena.
+//
+// Not thread safe; scenes are built on one thread.
+class scene_arena {
+public:
+	explicit scene_arena(size_t block_size = 256 * 1024) : block_size(block_size) {}
+	~scene_arena() { release(); }
+
+	scene_arena(const scene_arena&) = delete;
+	scene_arena& operator = (const scene_arena&) = delete;
+
+	template <typename T, typename... Args>
+	shared_ptr<T> make(Args&&... args) {
+		void* memory = allocate(sizeof(T), alignof(T));
+		T* object = new (memory) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value)
+			destructors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+		object_count++;
+		// Aliasing constructor with an empty owner: a pointer without a control block
+		return shared_ptr<T>(shared_ptr<T>(), object);
+	}
+
+	// Destroys all objects, newest first, and frees the blocks
+	void release() {
+		for (auto d = destructors.rbegin(); d != destructors.rend(); ++d)
+			d->destroy(d->object);
+		destructors.clear();
+		blocks.clear();
+		cursor = limit = nullptr;
+		bytes_used = 0;
+		object_count = 0;
+	}
+
+public:
+	size_t bytes_used = 0;		// including alignment padding
+	size_t object_count = 0;
+
+private:
+	void* allocate(size_t size, size_t align) {
+		uintptr_t start = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+		if (!cursor || start + size > reinterpret_cast<uintptr_t>(limit)) {
+			// Objects bigger than a block get a block of their own
+			size_t capacity = std::max(block_size, size + align);
+			blocks.emplace_back(new char[capacity]);
+			cursor = blocks.back().get();
+			limit = cursor + capacity;
+			start = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+		}
+		char* memory = reinterpret_cast<char*>(start);
+		bytes_used += memory + size - cursor;
+		cursor = memory + size;
+		return memory;
+	}
+
+	struct destructor {
+		void* object;
+		void (*destroy)(void*);
+	};
+
+	size_t block_size;
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* cursor = nullptr;
+	char* limit = nullptr;
+	std::vector<destructor> destructors;
+};
+
+#endif // !SCENE_ARENA_H
@@ -0,0 +1,311 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "rtcommon.h"
+
+// Binary caches of scene assets that are expensive to rebuild: meshes with
+// their built BVH and decoded texture texels. A cache file sits next to its
+// source (name + ".rtcache") and is memory-mapped read-only; the arrays in it
+// are used in place through array_views, without parsing or copying. The
+// header records a key hashed from the source file and everything else the
+// contents depend on, so a stale or foreign cache is simply rebuilt.
+
+// Bump whenever the layout of anything stored in a cache changes
+const uint32_t scene_cache_version = 1;
+
+// Set to false to ignore and not write any caches
+inline bool& scene_cache_enabled() {
+	static bool enabled = true;
+	return enabled;
+}
+
+inline std::string scene_cache_path(const std::string& source) {
+	return source + ".rtcache";
+}
+
+// Whole file mapped read-only, unmapped on destruction
+class mapped_file {
+public:
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator = (const mapped_file&) = delete;
+
+	// nullptr if the file can't be opened
+	static shared_ptr<mapped_file> open(const std::string& path);
+
+	~mapped_file();
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	mapped_file() {}
+
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+#ifdef _WIN32
+shared_ptr<mapped_file> mapped_file::open(const std::string& path) {
+	shared_ptr<mapped_file> result(new mapped_file());
+	result->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (result->file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(result->file, &size))
+		return nullptr;
+	result->length = static_cast<size_t>(size.QuadPart);
+	if (result->length == 0)
+		return result;
+
+	result->mapping = CreateFileMappingA(result->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!result->mapping)
+		return nullptr;
+	result->bytes = static_cast<const unsigned char*>(MapViewOfFile(result->mapping, FILE_MAP_READ, 0, 0, 0));
+	return result->bytes ? result : nullptr;
+}
+
+mapped_file::~mapped_file() {
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+#else
+shared_ptr<mapped_file> mapped_file::open(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	shared_ptr<mapped_file> result(new mapped_file());
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return nullptr;
+	}
+	result->length = static_cast<size_t>(info.st_size);
+
+	if (result->length > 0) {
+		void* p = mmap(nullptr, result->length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return nullptr;
+		}
+		result->bytes = static_cast<const unsigned char*>(p);
+	}
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+	return result;
+}
+
+mapped_file::~mapped_file() {
+	if (bytes)
+		munmap(const_cast<unsigned char*>(bytes), length);
+}
+#endif
+
+// 64-bit FNV-1a style hash, eight bytes per step
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+	const uint64_t prime = 0x100000001b3ull;
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++) {
+		uint64_t word;
+		std::memcpy(&word, p + 8 * i, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for (size_t i = 8 * words; i < size; i++)
+		hash = (hash ^ p[i]) * prime;
+	return hash;
+}
+
+template <typename T>
+inline uint64_t hash_value(const T& value, uint64_t hash) {
+	return hash_bytes(&value, sizeof(T), hash);
+}
+
+// Key for a cache built from the file at source_path, or 0 if it can't be read.
+// Mixes in the format version and the sizes of the stored types, so caches of
+// float and double builds don't get confused.
+inline uint64_t scene_cache_key(const std::string& source_path) {
+	auto source = mapped_file::open(source_path);
+	if (!source)
+		return 0;
+	uint64_t key = hash_bytes(source->data(), source->size());
+	key = hash_value(scene_cache_version, key);
+	key = hash_value(static_cast<uint32_t>(sizeof(real)), key);
+	return key;
+}
+
+struct scene_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t section_count;
+	uint64_t key;
+};
+
+struct scene_cache_section {
+	uint64_t offset;	// from the start of the file, a multiple of scene_cache_alignment
+	uint64_t size;		// in bytes
+};
+
+// Sections start on cache lines, which covers the alignment of every stored type
+const size_t scene_cache_alignment = 64;
+
+const char scene_cache_magic[8] = { 'R', 'T', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+// Collects arrays of trivially copyable values and writes them as the
+// sections of a cache file
+class scene_cache_writer {
+public:
+	template <typename T>
+	void add(const T* data, size_t count) {
+		sections.push_back({ data, count * sizeof(T) });
+	}
+
+	template <typename T>
+	void add(const std::vector<T>& v) {
+		add(v.data(), v.size());
+	}
+
+	// Writes to a temporary file first, so that a crash never leaves a
+	// truncated cache behind a valid header. The temporary file is named
+	// after the process, so jobs that write the same cache at the same time
+	// never write into each other's file; the last rename wins.
+	bool write(const std::string& path, uint64_t key) const {
+#ifdef _WIN32
+		std::string temp_path = path + "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+#else
+		std::string temp_path = path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+		std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		scene_cache_header header;
+		std::memcpy(header.magic, scene_cache_magic, sizeof(header.magic));
+		header.version = scene_cache_version;
+		header.section_count = static_cast<uint32_t>(sections.size());
+		header.key = key;
+
+		std::vector<scene_cache_section> table(sections.size());
+		uint64_t offset = align(sizeof(header) + table.size() * sizeof(scene_cache_section));
+		for (size_t i = 0; i < sections.size(); i++) {
+			table[i] = { offset, sections[i].second };
+			offset = align(offset + sections[i].second);
+		}
+
+		bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = ok && (table.empty() || std::fwrite(table.data(), sizeof(scene_cache_section), table.size(), file) == table.size());
+		uint64_t written = sizeof(header) + table.size() * sizeof(scene_cache_section);
+		const char zeros[scene_cache_alignment] = {};
+		for (size_t i = 0; ok && i < sections.size(); i++) {
+			ok = std::fwrite(zeros, 1, table[i].offset - written, file) == table[i].offset - written;
+			ok = ok && (sections[i].second == 0 || std::fwrite(sections[i].first, 1, sections[i].second, file) == sections[i].second);
+			written = table[i].offset + sections[i].second;
+		}
+		ok = std::fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+		// rename doesn't replace existing files on Windows
+		std::remove(path.c_str());
+#endif
+		// Replaces the old cache in one step; readers that mapped it keep their mapping
+		if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+			std::remove(temp_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static uint64_t align(uint64_t offset) {
+		return (offset + scene_cache_alignment - 1) / scene_cache_alignment * scene_cache_alignment;
+	}
+
+	std::vector<std::pair<const void*, size_t>> sections;
+};
+
+// Maps a cache file and hands out its sections as array_views, which stay
+// valid as long as file is kept
+class scene_cache_reader {
+public:
+	// False if the cache is missing, was built from something else or is damaged
+	bool open(const std::string& path, uint64_t key, uint32_t section_count) {
+		file = mapped_file::open(path);
+		if (!file || file->size() < sizeof(scene_cache_header))
+			return fail();
+
+		scene_cache_header header;
+		std::memcpy(&header, file->data(), sizeof(header));
+		if (std::memcmp(header.magic, scene_cache_magic, sizeof(header.magic)) != 0
+			|| header.version != scene_cache_version || header.key != key || header.section_count != section_count)
+			return fail();
+
+		size_t table_end = sizeof(header) + section_count * sizeof(scene_cache_section);
+		if (file->size() < table_end)
+			return fail();
+		table.resize(section_count);
+		std::memcpy(table.data(), file->data() + sizeof(header), section_count * sizeof(scene_cache_section));
+		for (const auto& section : table) {
+			if (section.offset % scene_cache_alignment != 0 || section.offset > file->size()
+				|| section.size > file->size() - section.offset)
+				return fail();
+		}
+		return true;
+	}
+
+	// Section i as an array of T, empty if its size doesn't fit T
+	template <typename T>
+	array_view<T> section(int i) const {
+		const scene_cache_section& s = table[i];
+		if (s.size % sizeof(T) != 0)
+			return array_view<T>();
+		return array_view<T>(reinterpret_cast<const T*>(file->data() + s.offset), static_cast<size_t>(s.size / sizeof(T)));
+	}
+
+	size_t section_size(int i) const { return static_cast<size_t>(table[i].size); }
+
+public:
+	shared_ptr<mapped_file> file;
+
+private:
+	bool fail() {
+		file = nullptr;
+		table.clear();
+		return false;
+	}
+
+	std::vector<scene_cache_section> table;
+};
+
+#endif // !SCENE_CACHE_H
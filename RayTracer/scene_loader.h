@@ -0,0 +1,678 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+#include "rtcommon.h"
+
+#include "bvh.h"
+#include "json.h"
+#include "scene.h"
+
+// Builds a scene from a JSON scene file, so scenes and their variants can be
+// rendered without recompiling. A file is one object with these members, all
+// optional:
+//
+//   "settings"   image and sampling settings, named like the scene members
+//                ("image_width", "samples_per_pixel", "integrator", ...)
+//   "camera"     "lookfrom", "lookat", "vup", "vfov", "dist_to_focus"
+//   "textures"   named textures, referenced by name from materials
+//   "materials"  named materials, referenced by name from objects
+//   "shapes"     named objects that are not placed by themselves, e.g. a
+//                mesh that instances refer to
+//   "objects"    the objects of the world
+//
+// Vectors and colors are [x, y, z] arrays. Wherever a texture, material or
+// object is expected, either the name of one or an inline definition may be
+// given. Relative file names are relative to the scene file. Unknown members
+// are ignored with a warning. See the scenes directory for examples.
+class scene_loader {
+public:
+	// False if the file can't be read or describes an invalid scene; the
+	// errors have been printed by then
+	bool load(const std::string& path, scene& s);
+
+private:
+	bool fail(const json_value& v, const std::string& message);
+	void warn_unknown_keys(const json_value& v, std::initializer_list<const char*> known);
+	std::string resolve_path(const std::string& file) const;
+
+	bool read_number(const json_value& v, const char* key, double& out);
+	bool read_int(const json_value& v, const char* key, int& out);
+	bool read_positive_int(const json_value& v, const char* key, int& out);
+	bool read_seed(const json_value& v, const char* key, uint64_t& out);
+	bool read_bool(const json_value& v, const char* key, bool& out);
+	bool read_vec3(const json_value& v, const char* key, vec3& out);
+	bool read_string(const json_value& v, const char* key, std::string& out);
+
+	double number(const json_value& v, const char* key, double fallback);
+	vec3 vector(const json_value& v, const char* key, const vec3& fallback);
+
+	void read_settings(const json_value& v, scene& s);
+	void read_camera(const json_value& v, scene& s);
+	affine_transform read_transform(const json_value& v);
+
+	shared_ptr<texture> make_texture(const json_value& v);
+	shared_ptr<material> make_material(const json_value& v);
+	shared_ptr<hittable> make_object(const json_value& v);
+	void make_objects(const json_value& v, hittable_list& list);
+
+	// Texture or material from the member key of v, which may also hold a color
+	shared_ptr<texture> texture_member(const json_value& v, const char* key);
+	shared_ptr<material> material_member(const json_value& v, const char* key);
+	shared_ptr<hittable> object_member(const json_value& v, const char* key);
+
+	// Objects go into the arena of the scene being loaded
+	template <typename T, typename... Args>
+	shared_ptr<T> make(Args&&... args) {
+		return target->make<T>(std::forward<Args>(args)...);
+	}
+
+	scene* target = nullptr;
+	std::string file_path;
+	std::string base_dir;
+	bool ok = true;
+	double time0 = 0, time1 = 1;
+
+	std::unordered_map<std::string, shared_ptr<texture>> textures;
+	std::unordered_map<std::string, shared_ptr<material>> materials;
+	std::unordered_map<std::string, shared_ptr<hittable>> shapes;
+};
+
+bool scene_loader::fail(const json_value& v, const std::string& message) {
+	std::cerr << "ERROR: " << file_path << ", line " << v.line << ": " << message << ".\n";
+	ok = false;
+	return false;
+}
+
+// Members not in known are most likely misspelled ones
+void scene_loader::warn_unknown_keys(const json_value& v, std::initializer_list<const char*> known) {
+	for (size_t i = 0; i < v.keys.size(); i++) {
+		if (std::none_of(known.begin(), known.end(), [&](const char* key) { return v.keys[i] == key; }))
+			std::cerr << "WARNING: " << file_path << ", line " << v[i].line << ": unknown key '" << v.keys[i] << "' ignored.\n";
+	}
+}
+
+std::string scene_loader::resolve_path(const std::string& file) const {
+	bool absolute = !file.empty() && (file[0] == '/' || file[0] == '\\' || (file.size() > 1 && file[1] == ':'));
+	return absolute ? file : base_dir + file;
+}
+
+bool scene_loader::read_number(const json_value& v, const char* key, double& out) {
+	const json_value* m = v.find(key);
+	if (!m)
+		return false;
+	if (!m->is_number())
+		return fail(*m, std::string("'") + key + "' must be a number");
+	out = m->number;
+	return true;
+}
+
+bool scene_loader::read_int(const json_value& v, const char* key, int& out) {
+	double d;
+	if (!read_number(v, key, d))
+		return false;
+	if (d != std::floor(d) || d < std::numeric_limits<int>::min() || d > std::numeric_limits<int>::max())
+		return fail(*v.find(key), std::string("'") + key + "' must be a whole number that fits an int");
+	out = static_cast<int>(d);
+	return true;
+}
+
+bool scene_loader::read_positive_int(const json_value& v, const char* key, int& out) {
+	int i;
+	if (!read_int(v, key, i))
+		return false;
+	if (i <= 0)
+		return fail(*v.find(key), std::string("'") + key + "' must be positive");
+	out = i;
+	return true;
+}
+
+// A whole number, or a string of decimal digits for seeds that a JSON number,
+// which is a double, can't hold exactly; the same range as --seed
+bool scene_loader::read_seed(const json_value& v, const char* key, uint64_t& out) {
+	const json_value* m = v.find(key);
+	if (!m)
+		return false;
+	if (m->is_number()) {
+		if (m->number != std::floor(m->number) || m->number < 0 || m->number > 9007199254740992.0)
+			return fail(*m, std::string("'") + key + "' must be a whole number from 0 to 2^53, or a string of digits");
+		out = static_cast<uint64_t>(m->number);
+		return true;
+	}
+	if (m->is_string()) {
+		const char* text = m->string.c_str();
+		char* end = nullptr;
+		errno = 0;
+		uint64_t value = std::strtoull(text, &end, 10);
+		if (std::isdigit(static_cast<unsigned char>(text[0])) && *end == '\0' && errno != ERANGE) {
+			out = value;
+			return true;
+		}
+	}
+	return fail(*m, std::string("'") + key + "' must be a whole number from 0 to 2^53, or a string of digits");
+}
+
+bool scene_loader::read_bool(const json_value& v, const char* key, bool& out) {
+	const json_value* m = v.find(key);
+	if (!m)
+		return false;
+	if (!m->is_bool())
+		return fail(*m, std::string("'") + key + "' must be true or false");
+	out = m->boolean;
+	return true;
+}
+
+bool scene_loader::read_vec3(const json_value& v, const char* key, vec3& out) {
+	const json_value* m = v.find(key);
+	if (!m)
+		return false;
+	if (!m->is_array() || m->size() != 3 || !(*m)[0].is_number() || !(*m)[1].is_number() || !(*m)[2].is_number())
+		return fail(*m, std::string("'") + key + "' must be an array of three numbers");
+	out = vec3((*m)[0].number, (*m)[1].number, (*m)[2].number);
+	return true;
+}
+
+bool scene_loader::read_string(const json_value& v, const char* key, std::string& out) {
+	const json_value* m = v.find(key);
+	if (!m)
+		return false;
+	if (!m->is_string())
+		return fail(*m, std::string("'") + key + "' must be a string");
+	out = m->string;
+	return true;
+}
+
+double scene_loader::number(const json_value& v, const char* key, double fallback) {
+	read_number(v, key, fallback);
+	return fallback;
+}
+
+vec3 scene_loader::vector(const json_value& v, const char* key, const vec3& fallback) {
+	vec3 result = fallback;
+	read_vec3(v, key, result);
+	return result;
+}
+
+void scene_loader::read_settings(const json_value& v, scene& s) {
+	warn_unknown_keys(v, { "image_width", "aspect_ratio", "samples_per_pixel", "max_depth", "background",
+		"seed", "tile_size", "pass_samples", "time_budget", "roulette_depth", "packet_tracing",
+		"static_dispatch", "adaptive_sampling", "min_samples", "adaptive_threshold", "integrator" });
+	read_positive_int(v, "image_width", s.image_width);
+	double aspect_ratio;
+	if (read_number(v, "aspect_ratio", aspect_ratio)) {
+		if (aspect_ratio > 0)
+			s.aspect_ratio = aspect_ratio;
+		else
+			fail(*v.find("aspect_ratio"), "'aspect_ratio' must be positive");
+	}
+	read_positive_int(v, "samples_per_pixel", s.samples_per_pixel);
+	read_positive_int(v, "max_depth", s.max_depth);
+	read_vec3(v, "background", s.background);
+	read_seed(v, "seed", s.seed);
+	read_positive_int(v, "tile_size", s.tile_size);
+	read_int(v, "pass_samples", s.pass_samples);
+	read_number(v, "time_budget", s.time_budget);
+	read_int(v, "roulette_depth", s.roulette_depth);
+	read_bool(v, "packet_tracing", s.packet_tracing);
+	read_bool(v, "static_dispatch", s.static_dispatch);
+	read_bool(v, "adaptive_sampling", s.adaptive_sampling);
+	read_int(v, "min_samples", s.min_samples);
+	read_number(v, "adaptive_threshold", s.adaptive_threshold);
+
+	std::string integrator;
+	if (read_string(v, "integrator", integrator)) {
+		if (integrator == "recursive")
+			s.integrator = integrator_type::recursive;
+		else if (integrator == "iterative")
+			s.integrator = integrator_type::iterative;
+		else if (integrator == "nee")
+			s.integrator = integrator_type::nee;
+		else
+			fail(*v.find("integrator"), "unknown integrator '" + integrator + "'");
+	}
+}
+
+// The renderer's camera is a pinhole with a shutter open from time 0 to 1,
+// so there is no aperture or shutter time to set
+void scene_loader::read_camera(const json_value& v, scene& s) {
+	warn_unknown_keys(v, { "lookfrom", "lookat", "vup", "vfov", "dist_to_focus" });
+	read_vec3(v, "lookfrom", s.lookfrom);
+	read_vec3(v, "lookat", s.lookat);
+	read_vec3(v, "vup", s.vup);
+	read_number(v, "vfov", s.vfov);
+	read_number(v, "dist_to_focus", s.dist_to_focus);
+}
+
+// A list of steps, applied first to last:
+// [{"scale": 2}, {"rotate": [0, 1, 0], "degrees": 30}, {"translate": [1, 0, 0]}]
+affine_transform scene_loader::read_transform(const json_value& v) {
+	affine_transform t;
+	if (!v.is_array()) {
+		fail(v, "a transform must be an array of steps");
+		return t;
+	}
+
+	for (size_t i = 0; i < v.size(); i++) {
+		const json_value& step = v[i];
+		warn_unknown_keys(step, { "translate", "rotate", "degrees", "scale" });
+		const json_value* scale = step.find("scale");
+		vec3 offset, axis;
+		if (read_vec3(step, "translate", offset)) {
+			t = affine_transform::translation(offset) * t;
+		}
+		else if (read_vec3(step, "rotate", axis)) {
+			t = affine_transform::rotation(axis, number(step, "degrees", 0)) * t;
+		}
+		else if (scale && scale->is_number()) {
+			t = affine_transform::scaling(scale->number) * t;
+		}
+		else if (read_vec3(step, "scale", axis)) {
+			t = affine_transform::scaling(axis) * t;
+		}
+		else if (ok) {
+			fail(step, "a transform step needs 'translate', 'rotate' or 'scale'");
+		}
+	}
+	return t;
+}
+
+shared_ptr<texture> scene_loader::texture_member(const json_value& v, const char* key) {
+	const json_value* m = v.find(key);
+	if (!m) {
+		fail(v, std::string("missing '") + key + "'");
+		return nullptr;
+	}
+	if (m->is_array()) {
+		vec3 c;
+		return read_vec3(v, key, c) ? make<solid_color>(c) : nullptr;
+	}
+	if (m->is_string()) {
+		auto found = textures.find(m->string);
+		if (found == textures.end()) {
+			fail(*m, "unknown texture '" + m->string + "'");
+			return nullptr;
+		}
+		return found->second;
+	}
+	return make_texture(*m);
+}
+
+shared_ptr<material> scene_loader::material_member(const json_value& v, const char* key) {
+	const json_value* m = v.find(key);
+	if (!m) {
+		fail(v, std::string("missing '") + key + "'");
+		return nullptr;
+	}
+	if (m->is_string()) {
+		auto found = materials.find(m->string);
+		if (found == materials.end()) {
+			fail(*m, "unknown material '" + m->string + "'");
+			return nullptr;
+		}
+		return found->second;
+	}
+	return make_material(*m);
+}
+
+shared_ptr<hittable> scene_loader::object_member(const json_value& v, const char* key) {
+	const json_value* m = v.find(key);
+	if (!m) {
+		fail(v, std::string("missing '") + key + "'");
+		return nullptr;
+	}
+	return make_object(*m);
+}
+
+// "solid" {"color"}, "checker" {"even", "odd"}, "noise" {"scale"}, "image" {"file"}
+shared_ptr<texture> scene_loader::make_texture(const json_value& v) {
+	std::string type;
+	if (!read_string(v, "type", type)) {
+		fail(v, "a texture needs a 'type'");
+		return nullptr;
+	}
+
+	if (type == "solid") {
+		warn_unknown_keys(v, { "type", "color" });
+		return make<solid_color>(vector(v, "color", color(0, 0, 0)));
+	}
+	if (type == "checker") {
+		warn_unknown_keys(v, { "type", "even", "odd" });
+		auto even = texture_member(v, "even");
+		auto odd = texture_member(v, "odd");
+		return even && odd ? make<checker_texture>(even, odd) : nullptr;
+	}
+	if (type == "noise") {
+		warn_unknown_keys(v, { "type", "scale" });
+		return make<noise_texture>(number(v, "scale", 1));
+	}
+	if (type == "image") {
+		warn_unknown_keys(v, { "type", "file" });
+		std::string file;
+		if (!read_string(v, "file", file)) {
+			fail(v, "an image texture needs a 'file'");
+			return nullptr;
+		}
+		return make<image_texture>(resolve_path(file).c_str());
+	}
+
+	fail(v, "unknown texture type '" + type + "'");
+	return nullptr;
+}
+
+// "lambertian" {"albedo"}, "metal" {"albedo", "fuzz"}, "dielectric" {"ir"},
+// "diffuse_light" {"emit"}, "isotropic" {"albedo"}. Albedo and emit take a
+// color or a texture.
+shared_ptr<material> scene_loader::make_material(const json_value& v) {
+	std::string type;
+	if (!read_string(v, "type", type)) {
+		fail(v, "a material needs a 'type'");
+		return nullptr;
+	}
+
+	if (type == "lambertian") {
+		warn_unknown_keys(v, { "type", "albedo" });
+		auto albedo = texture_member(v, "albedo");
+		return albedo ? make<lambertian>(albedo) : nullptr;
+	}
+	if (type == "metal") {
+		warn_unknown_keys(v, { "type", "albedo", "fuzz" });
+		return make<metal>(vector(v, "albedo", color(0, 0, 0)), number(v, "fuzz", 0));
+	}
+	if (type == "dielectric") {
+		warn_unknown_keys(v, { "type", "ir" });
+		return make<dielectric>(number(v, "ir", 1.5));
+	}
+	if (type == "diffuse_light") {
+		warn_unknown_keys(v, { "type", "emit" });
+		auto emit = texture_member(v, "emit");
+		return emit ? make<diffuse_light>(emit) : nullptr;
+	}
+	if (type == "isotropic") {
+		warn_unknown_keys(v, { "type", "albedo" });
+		auto albedo = texture_member(v, "albedo");
+		return albedo ? make<isotropic>(albedo) : nullptr;
+	}
+
+	fail(v, "unknown material type '" + type + "'");
+	return nullptr;
+}
+
+void scene_loader::make_objects(const json_value& v, hittable_list& list) {
+	if (!v.is_array()) {
+		fail(v, "'objects' must be an array");
+		return;
+	}
+	for (size_t i = 0; i < v.size(); i++) {
+		auto object = make_object(v[i]);
+		if (object)
+			list.add(object);
+	}
+}
+
+// Object types and their members:
+//   "sphere"          center, radius, material
+//   "moving_sphere"   center0, center1, time0, time1, radius, material
+//   "xy_rect"         x0, x1, y0, y1, k, material (likewise "xz_rect", "yz_rect")
+//   "box"             min, max, material
+//   "constant_medium" boundary (an object), density, albedo
+//   "sphere_set"      spheres: [{center, radius, material}, ...]
+//   "mesh"            file (OBJ), material
+//   "list"            objects
+//   "bvh"             objects, accel ("wide", "flat" or "binary", default wide)
+//   "translate"       object, offset
+//   "rotate_y"        object, degrees
+//   "instance"        object, transform, material (optional override)
+//   "instances"       instances: [{object, transform, material}, ...], an instance_bvh
+shared_ptr<hittable> scene_loader::make_object(const json_value& v) {
+	if (v.is_string()) {
+		auto found = shapes.find(v.string);
+		if (found == shapes.end()) {
+			fail(v, "unknown shape '" + v.string + "'");
+			return nullptr;
+		}
+		return found->second;
+	}
+
+	std::string type;
+	if (!read_string(v, "type", type)) {
+		fail(v, "an object needs a 'type'");
+		return nullptr;
+	}
+
+	if (type == "sphere") {
+		warn_unknown_keys(v, { "type", "center", "radius", "material" });
+		auto m = material_member(v, "material");
+		return m ? make<sphere>(vector(v, "center", point3(0, 0, 0)), number(v, "radius", 1), m) : nullptr;
+	}
+	if (type == "moving_sphere") {
+		warn_unknown_keys(v, { "type", "center0", "center1", "time0", "time1", "radius", "material" });
+		auto m = material_member(v, "material");
+		if (!m)
+			return nullptr;
+		return make<moving_sphere>(vector(v, "center0", point3(0, 0, 0)), vector(v, "center1", point3(0, 0, 0)),
+			number(v, "time0", 0), number(v, "time1", 1), number(v, "radius", 1), m);
+	}
+	if (type == "xy_rect" || type == "xz_rect" || type == "yz_rect") {
+		auto m = material_member(v, "material");
+		if (!m)
+			return nullptr;
+		// The names of the two in-plane axes, e.g. x and z for xz_rect
+		std::string a0 = type.substr(0, 1) + "0", a1 = type.substr(0, 1) + "1";
+		std::string b0 = type.substr(1, 1) + "0", b1 = type.substr(1, 1) + "1";
+		warn_unknown_keys(v, { "type", a0.c_str(), a1.c_str(), b0.c_str(), b1.c_str(), "k", "material" });
+		double u0 = number(v, a0.c_str(), 0), u1 = number(v, a1.c_str(), 0);
+		double w0 = number(v, b0.c_str(), 0), w1 = number(v, b1.c_str(), 0);
+		double k = number(v, "k", 0);
+		if (type == "xy_rect")
+			return make<xy_rect>(u0, u1, w0, w1, k, m);
+		if (type == "xz_rect")
+			return make<xz_rect>(u0, u1, w0, w1, k, m);
+		return make<yz_rect>(u0, u1, w0, w1, k, m);
+	}
+	if (type == "box") {
+		warn_unknown_keys(v, { "type", "min", "max", "material" });
+		auto m = material_member(v, "material");
+		return m ? make<box>(vector(v, "min", point3(0, 0, 0)), vector(v, "max", point3(1, 1, 1)), m) : nullptr;
+	}
+	if (type == "constant_medium") {
+		warn_unknown_keys(v, { "type", "boundary", "density", "albedo" });
+		auto boundary = object_member(v, "boundary");
+		auto albedo = texture_member(v, "albedo");
+		if (!boundary || !albedo)
+			return nullptr;
+		return make<constant_medium>(boundary, number(v, "density", 1), albedo);
+	}
+	if (type == "sphere_set") {
+		warn_unknown_keys(v, { "type", "spheres" });
+		const json_value* spheres = v.find("spheres");
+		if (!spheres || !spheres->is_array()) {
+			fail(v, "a sphere_set needs a 'spheres' array");
+			return nullptr;
+		}
+		auto set = make<sphere_set>();
+		for (size_t i = 0; i < spheres->size(); i++) {
+			const json_value& s = (*spheres)[i];
+			warn_unknown_keys(s, { "center", "radius", "material" });
+			auto m = material_member(s, "material");
+			if (m)
+				set->add(vector(s, "center", point3(0, 0, 0)), number(s, "radius", 1), m);
+		}
+		set->build();
+		return set;
+	}
+	if (type == "mesh") {
+		warn_unknown_keys(v, { "type", "file", "material" });
+		std::string file;
+		if (!read_string(v, "file", file)) {
+			fail(v, "a mesh needs a 'file'");
+			return nullptr;
+		}
+		auto m = material_member(v, "material");
+		if (!m)
+			return nullptr;
+		auto mesh = load_obj(resolve_path(file).c_str(), m);
+		if (mesh->triangle_count() == 0) {
+			fail(v, "mesh '" + file + "' has no triangles");
+			return nullptr;
+		}
+		return mesh;
+	}
+	if (type == "list") {
+		warn_unknown_keys(v, { "type", "objects" });
+		auto list = make<hittable_list>();
+		if (const json_value* objects = v.find("objects"))
+			make_objects(*objects, *list);
+		return list;
+	}
+	if (type == "bvh") {
+		warn_unknown_keys(v, { "type", "objects", "accel" });
+		hittable_list list;
+		if (const json_value* objects = v.find("objects"))
+			make_objects(*objects, list);
+		if (list.objects.empty()) {
+			fail(v, "a bvh needs 'objects'");
+			return nullptr;
+		}
+		std::string accel = "wide";
+		read_string(v, "accel", accel);
+		if (accel == "wide")
+			return make<wide_bvh>(list, time0, time1);
+		if (accel == "flat")
+			return make<flat_bvh>(list, time0, time1);
+		if (accel == "binary")
+			return make<bvh_node>(list, time0, time1, target->arena.get());
+		fail(v, "unknown bvh accel '" + accel + "'");
+		return nullptr;
+	}
+	if (type == "translate") {
+		warn_unknown_keys(v, { "type", "object", "offset" });
+		auto object = object_member(v, "object");
+		return object ? make<translate>(object, vector(v, "offset", vec3(0, 0, 0))) : nullptr;
+	}
+	if (type == "rotate_y") {
+		warn_unknown_keys(v, { "type", "object", "degrees" });
+		auto object = object_member(v, "object");
+		return object ? make<rotate_y>(object, number(v, "degrees", 0)) : nullptr;
+	}
+	if (type == "instance") {
+		warn_unknown_keys(v, { "type", "object", "transform", "material" });
+		auto object = object_member(v, "object");
+		if (!object)
+			return nullptr;
+		const json_value* transform = v.find("transform");
+		shared_ptr<material> m = v.find("material") ? material_member(v, "material") : nullptr;
+		return make<instance>(object, transform ? read_transform(*transform) : affine_transform(), m);
+	}
+	if (type == "instances") {
+		warn_unknown_keys(v, { "type", "instances" });
+		const json_value* instances = v.find("instances");
+		if (!instances || !instances->is_array() || instances->size() == 0) {
+			fail(v, "'instances' needs an 'instances' array");
+			return nullptr;
+		}
+		auto bvh = make<instance_bvh>();
+		for (size_t i = 0; i < instances->size(); i++) {
+			const json_value& placement = (*instances)[i];
+			warn_unknown_keys(placement, { "object", "transform", "material" });
+			auto object = object_member(placement, "object");
+			if (!object)
+				continue;
+			const json_value* transform = placement.find("transform");
+			shared_ptr<material> m = placement.find("material") ? material_member(placement, "material") : nullptr;
+			bvh->add(object, transform ? read_transform(*transform) : affine_transform(), m);
+		}
+		bvh->build(time0, time1);
+		return bvh;
+	}
+
+	fail(v, "unknown object type '" + type + "'");
+	return nullptr;
+}
+
+bool scene_loader::load(const std::string& path, scene& s) {
+	auto start = std::chrono::high_resolution_clock::now();
+	auto elapsed_ms = [&]() {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	target = &s;
+	file_path = path;
+	size_t slash = path.find_last_of("/\\");
+	base_dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+	json_value root;
+	if (!parse_json_file(path, root))
+		return false;
+	double parse_ms = elapsed_ms();
+	if (!root.is_object())
+		return fail(root, "a scene file must hold an object");
+
+	warn_unknown_keys(root, { "settings", "camera", "textures", "materials", "shapes", "objects" });
+	s.set_image_defaults();
+	if (const json_value* settings = root.find("settings"))
+		read_settings(*settings, s);
+	if (const json_value* camera = root.find("camera"))
+		read_camera(*camera, s);
+	time0 = s.t0;
+	time1 = s.t1;
+
+	// Definitions may refer to the ones listed before them
+	for (const char* key : { "textures", "materials", "shapes" }) {
+		const json_value* list = root.find(key);
+		if (list && !list->is_object())
+			fail(*list, std::string("'") + key + "' must be an object of named definitions");
+	}
+	if (!ok)
+		return false;
+	if (const json_value* list = root.find("textures")) {
+		for (size_t i = 0; i < list->size(); i++) {
+			auto t = make_texture((*list)[i]);
+			if (t)
+				textures[list->keys[i]] = t;
+		}
+	}
+	if (const json_value* list = root.find("materials")) {
+		for (size_t i = 0; i < list->size(); i++) {
+			auto m = make_material((*list)[i]);
+			if (m)
+				materials[list->keys[i]] = m;
+		}
+	}
+	if (const json_value* list = root.find("shapes")) {
+		for (size_t i = 0; i < list->size(); i++) {
+			auto object = make_object((*list)[i]);
+			if (object)
+				shapes[list->keys[i]] = object;
+		}
+	}
+
+	s.world.clear();
+	if (const json_value* objects = root.find("objects"))
+		make_objects(*objects, s.world);
+
+	if (!ok)
+		return false;
+
+	std::cout << "Loaded scene '" << path << "': " << s.world.objects.size() << " objects, parsed in "
+		<< parse_ms << " ms, built in " << elapsed_ms() - parse_ms << " ms\n";
+	return true;
+}
+
+// Replaces s with the scene described by the file at path
+inline bool load_scene_file(const std::string& path, scene& s) {
+	scene_loader loader;
+	return loader.load(path, s);
+}
+
+#endif // !SCENE_LOADER_H
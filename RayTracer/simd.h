@@ -0,0 +1,573 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "rtcommon.h"
+
+#include "aabb.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets any function use AVX intrinsics, GCC and Clang need them enabled per function
+#if defined(RT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET_AVX __attribute__((target("avx")))
+#else
+#define RT_TARGET_AVX
+#endif
+
+// Instruction set used by the packet kernels, picked at runtime
+enum class simd_level {
+	scalar,
+	sse2,	// two rays per instruction
+	avx		// all four rays per instruction
+};
+
+inline const char* simd_level_name(simd_level level) {
+	switch (level) {
+	case simd_level::avx: return "AVX";
+	case simd_level::sse2: return "SSE2";
+	default: return "scalar";
+	}
+}
+
+inline simd_level detect_simd_level() {
+#if defined(RT_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	// The OS also has to save the upper halves of the registers on context switches
+	if (avx && osxsave && (_xgetbv(0) & 6) == 6)
+		return simd_level::avx;
+	return (info[3] & (1 << 26)) != 0 ? simd_level::sse2 : simd_level::scalar;
+#elif defined(RT_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return simd_level::avx;
+	if (__builtin_cpu_supports("sse2"))
+		return simd_level::sse2;
+	return simd_level::scalar;
+#else
+	return simd_level::scalar;
+#endif
+}
+
+// Four rays traced together, e.g. the camera rays of a 2x2 pixel block. The
+// rays are kept as they are for the per-primitive tests and transposed into
+// one array per component for the box tests. Lanes are addressed by bit masks,
+// bit i standing for rays[i].
+struct ray_packet {
+	static const int size = 4;
+	static const int all_lanes = (1 << size) - 1;
+
+	void set(int lane, const ray& r) {
+		rays[lane] = r;
+		for (int a = 0; a < 3; a++) {
+			origin[a][lane] = r.origin()[a];
+			inv_direction[a][lane] = r.inv_dir[a];
+		}
+	}
+
+	ray rays[size];
+
+	alignas(32) real origin[3][size];
+	alignas(32) real inv_direction[3][size];
+};
+
+// Bounds of the four children of a wide BVH node, one array per component so
+// that a single SIMD slab test covers all children. Nodes live in std::vector,
+// which does not honour the alignment before C++17, so the kernels use
+// unaligned loads.
+struct wide_bounds {
+	static const int width = 4;
+
+	alignas(32) real min[3][width];
+	alignas(32) real max[3][width];
+};
+
+// min and max as the SSE and AVX instructions compute them: the second operand
+// if either one is NaN. The scalar kernels use these so that they agree with
+// the SIMD ones on rays lying in a slab plane (0 * inf).
+inline real simd_min(real a, real b) { return a < b ? a : b; }
+inline real simd_max(real a, real b) { return a > b ? a : b; }
+
+// Slab test of every lane in active against box, each within [t_min, t_max[lane]].
+// Returns the mask of lanes that hit.
+inline int packet_box_hit_scalar(const aabb& box, const ray_packet& p, int active, real t_min, const real* t_max) {
+	int hits = 0;
+	for (int lane = 0; lane < ray_packet::size; lane++) {
+		if (!(active & (1 << lane)))
+			continue;
+
+		real t_near = t_min, t_far = t_max[lane];
+		for (int a = 0; a < 3; a++) {
+			real t0 = (box.minimum[a] - p.origin[a][lane]) * p.inv_direction[a][lane];
+			real t1 = (box.maximum[a] - p.origin[a][lane]) * p.inv_direction[a][lane];
+			t_near = simd_max(simd_min(t0, t1), t_near);
+			t_far = simd_min(simd_max(t0, t1), t_far);
+		}
+		if (t_near < t_far)
+			hits |= 1 << lane;
+	}
+	return hits;
+}
+
+// The exit distance of the wide slab tests is scaled up by this much before it
+// is compared, so that rounding cannot cull a box the ray only touches in a
+// corner, e.g. a ray aimed exactly at a mesh vertex (Ize, "Robust BVH Ray
+// Traversal", JCGT 2013).
+const real slab_exit_scale = 1 + 4 * std::numeric_limits<real>::epsilon();
+
+// Slab test of one ray against all four boxes of b. Returns the mask of boxes
+// hit within [t_min, t_max] and stores the entry distances in t_near.
+inline int wide_box_hit_scalar(const wide_bounds& b, const real* origin, const real* inv_direction,
+	real t_min, real t_max, real* t_near) {
+	int hits = 0;
+	for (int i = 0; i < wide_bounds::width; i++) {
+		real t_enter = t_min, t_exit = t_max;
+		for (int a = 0; a < 3; a++) {
+			real t0 = (b.min[a][i] - origin[a]) * inv_direction[a];
+			real t1 = (b.max[a][i] - origin[a]) * inv_direction[a];
+			t_enter = simd_max(simd_min(t0, t1), t_enter);
+			t_exit = simd_min(simd_max(t0, t1), t_exit);
+		}
+		t_near[i] = t_enter;
+		if (t_enter <= t_exit * slab_exit_scale)
+			hits |= 1 << i;
+	}
+	return hits;
+}
+
+// Spheres of a sphere_set, one array per component. The arrays are padded so
+// that a kernel can always load a full register past the last sphere.
+struct sphere_soa {
+	const real* center[3];
+	const real* radius;
+};
+
+// Closest hit of r among spheres [first, first + count) of s within
+// [t_min, t_max]. Same arithmetic as sphere_roots, so the results match
+// sphere::hit. Returns the sphere's index and shrinks t_max to its distance,
+// or returns -1.
+inline int sphere_hit_scalar(const sphere_soa& s, int first, int count, const ray& r, real t_min, real& t_max) {
+	const vec3& o = r.origin();
+	const vec3& d = r.direction();
+	real a = d.length_squared();
+	int best = -1;
+
+	for (int i = first; i < first + count; i++) {
+		real oc[3] = { o[0] - s.center[0][i], o[1] - s.center[1][i], o[2] - s.center[2][i] };
+		real radius2 = s.radius[i] * s.radius[i];
+		real half_b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+		real c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - radius2;
+
+		real k = half_b / a;
+		real to_line[3] = { oc[0] - k * d[0], oc[1] - k * d[1], oc[2] - k * d[2] };
+		real discriminant = a * (radius2 - (to_line[0] * to_line[0] + to_line[1] * to_line[1] + to_line[2] * to_line[2]));
+		if (discriminant < 0)
+			continue;
+
+		real q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+		real near_root = 0, far_root = 0;
+		if (q != 0) {
+			near_root = c / q;
+			far_root = q / a;
+			if (near_root > far_root)
+				std::swap(near_root, far_root);
+		}
+
+		real root = near_root;
+		if (root < t_min || t_max < root) {
+			root = far_root;
+			if (root < t_min || t_max < root)
+				continue;
+		}
+		t_max = root;
+		best = i;
+	}
+	return best;
+}
+
+// Takes the hits of one SIMD batch starting at sphere base in lane order, like
+// the scalar loop, so that ties go to the same sphere
+inline int sphere_pick_closest(const real* roots, int mask, int base, real& t_max, int best) {
+	for (int lane = 0; mask; lane++, mask >>= 1) {
+		if ((mask & 1) && roots[lane] <= t_max) {
+			t_max = roots[lane];
+			best = base + lane;
+		}
+	}
+	return best;
+}
+
+// In the SIMD kernels, min/max return their second operand if either one is
+// NaN (0 * inf for a ray inside a slab plane), so the running interval is
+// always passed second.
+#if defined(RT_X86) && defined(RT_USE_FLOAT)
+// Four floats fill an SSE register, so float builds have no AVX kernels and
+// run the SSE2 ones on CPUs with AVX as well (see kernel_simd_level)
+
+inline int packet_box_hit_sse2(const aabb& box, const ray_packet& p, int active, real t_min, const real* t_max) {
+	__m128 t_near = _mm_set1_ps(t_min);
+	__m128 t_far = _mm_loadu_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m128 o = _mm_load_ps(p.origin[a]);
+		__m128 inv = _mm_load_ps(p.inv_direction[a]);
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.minimum[a]), o), inv);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.maximum[a]), o), inv);
+		t_near = _mm_max_ps(_mm_min_ps(t0, t1), t_near);
+		t_far = _mm_min_ps(_mm_max_ps(t0, t1), t_far);
+	}
+	return _mm_movemask_ps(_mm_cmplt_ps(t_near, t_far)) & active;
+}
+
+inline int wide_box_hit_sse2(const wide_bounds& b, const real* origin, const real* inv_direction,
+	real t_min, real t_max, real* t_near) {
+	__m128 t_enter = _mm_set1_ps(t_min);
+	__m128 t_exit = _mm_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m128 o = _mm_set1_ps(origin[a]);
+		__m128 inv = _mm_set1_ps(inv_direction[a]);
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.min[a]), o), inv);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.max[a]), o), inv);
+		t_enter = _mm_max_ps(_mm_min_ps(t0, t1), t_enter);
+		t_exit = _mm_min_ps(_mm_max_ps(t0, t1), t_exit);
+	}
+	_mm_storeu_ps(t_near, t_enter);
+	t_exit = _mm_mul_ps(t_exit, _mm_set1_ps(slab_exit_scale));
+	return _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+}
+
+inline int sphere_hit_sse2(const sphere_soa& s, int first, int count, const ray& r, real t_min, real& t_max) {
+	const __m128 sign_bit = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 o[3], d[3];
+	for (int a = 0; a < 3; a++) {
+		o[a] = _mm_set1_ps(r.origin()[a]);
+		d[a] = _mm_set1_ps(r.direction()[a]);
+	}
+	__m128 a = _mm_set1_ps(r.direction().length_squared());
+	__m128 lo_bound = _mm_set1_ps(t_min);
+	alignas(16) real roots[4];
+	int best = -1;
+
+	for (int i = 0; i < count; i += 4) {
+		int base = first + i;
+		__m128 oc[3];
+		for (int k = 0; k < 3; k++)
+			oc[k] = _mm_sub_ps(o[k], _mm_loadu_ps(s.center[k] + base));
+		__m128 radius = _mm_loadu_ps(s.radius + base);
+		__m128 radius2 = _mm_mul_ps(radius, radius);
+		__m128 half_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(oc[0], d[0]), _mm_mul_ps(oc[1], d[1])), _mm_mul_ps(oc[2], d[2]));
+		__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(oc[0], oc[0]), _mm_mul_ps(oc[1], oc[1])), _mm_mul_ps(oc[2], oc[2])), radius2);
+
+		__m128 k = _mm_div_ps(half_b, a);
+		__m128 l[3];
+		for (int j = 0; j < 3; j++)
+			l[j] = _mm_sub_ps(oc[j], _mm_mul_ps(k, d[j]));
+		__m128 to_line2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l[0], l[0]), _mm_mul_ps(l[1], l[1])), _mm_mul_ps(l[2], l[2]));
+		__m128 discriminant = _mm_mul_ps(a, _mm_sub_ps(radius2, to_line2));
+		__m128 valid = _mm_cmpge_ps(discriminant, zero);
+		if (!_mm_movemask_ps(valid))
+			continue;
+
+		// q = -(half_b + copysign(sqrt(discriminant), half_b))
+		__m128 signed_sqrt = _mm_or_ps(_mm_sqrt_ps(discriminant), _mm_and_ps(half_b, sign_bit));
+		__m128 q = _mm_xor_ps(_mm_add_ps(half_b, signed_sqrt), sign_bit);
+		__m128 r0 = _mm_div_ps(c, q);
+		__m128 r1 = _mm_div_ps(q, a);
+		__m128 q_zero = _mm_cmpeq_ps(q, zero);
+		__m128 near_root = _mm_andnot_ps(q_zero, _mm_min_ps(r0, r1));
+		__m128 far_root = _mm_andnot_ps(q_zero, _mm_max_ps(r0, r1));
+
+		__m128 hi_bound = _mm_set1_ps(t_max);
+		__m128 near_ok = _mm_and_ps(_mm_cmpge_ps(near_root, lo_bound), _mm_cmple_ps(near_root, hi_bound));
+		__m128 far_ok = _mm_and_ps(_mm_cmpge_ps(far_root, lo_bound), _mm_cmple_ps(far_root, hi_bound));
+		int mask = _mm_movemask_ps(_mm_and_ps(valid, _mm_or_ps(near_ok, far_ok)));
+		if (count - i < 4)
+			mask &= (1 << (count - i)) - 1;
+		if (!mask)
+			continue;
+
+		_mm_store_ps(roots, _mm_or_ps(_mm_and_ps(near_ok, near_root), _mm_andnot_ps(near_ok, far_root)));
+		best = sphere_pick_closest(roots, mask, base, t_max, best);
+	}
+	return best;
+}
+
+#elif defined(RT_X86)
+inline int packet_box_hit_sse2(const aabb& box, const ray_packet& p, int active, real t_min, const real* t_max) {
+	int hits = 0;
+	for (int half = 0; half < ray_packet::size; half += 2) {
+		__m128d t_near = _mm_set1_pd(t_min);
+		__m128d t_far = _mm_loadu_pd(t_max + half);
+		for (int a = 0; a < 3; a++) {
+			__m128d o = _mm_load_pd(p.origin[a] + half);
+			__m128d inv = _mm_load_pd(p.inv_direction[a] + half);
+			__m128d t0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(box.minimum[a]), o), inv);
+			__m128d t1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(box.maximum[a]), o), inv);
+			t_near = _mm_max_pd(_mm_min_pd(t0, t1), t_near);
+			t_far = _mm_min_pd(_mm_max_pd(t0, t1), t_far);
+		}
+		hits |= _mm_movemask_pd(_mm_cmplt_pd(t_near, t_far)) << half;
+	}
+	return hits & active;
+}
+
+RT_TARGET_AVX
+inline int packet_box_hit_avx(const aabb& box, const ray_packet& p, int active, real t_min, const real* t_max) {
+	__m256d t_near = _mm256_set1_pd(t_min);
+	__m256d t_far = _mm256_loadu_pd(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m256d o = _mm256_load_pd(p.origin[a]);
+		__m256d inv = _mm256_load_pd(p.inv_direction[a]);
+		__m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box.minimum[a]), o), inv);
+		__m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box.maximum[a]), o), inv);
+		t_near = _mm256_max_pd(_mm256_min_pd(t0, t1), t_near);
+		t_far = _mm256_min_pd(_mm256_max_pd(t0, t1), t_far);
+	}
+	return _mm256_movemask_pd(_mm256_cmp_pd(t_near, t_far, _CMP_LT_OQ)) & active;
+}
+
+inline int wide_box_hit_sse2(const wide_bounds& b, const real* origin, const real* inv_direction,
+	real t_min, real t_max, real* t_near) {
+	int hits = 0;
+	for (int half = 0; half < wide_bounds::width; half += 2) {
+		__m128d t_enter = _mm_set1_pd(t_min);
+		__m128d t_exit = _mm_set1_pd(t_max);
+		for (int a = 0; a < 3; a++) {
+			__m128d o = _mm_set1_pd(origin[a]);
+			__m128d inv = _mm_set1_pd(inv_direction[a]);
+			__m128d t0 = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(b.min[a] + half), o), inv);
+			__m128d t1 = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(b.max[a] + half), o), inv);
+			t_enter = _mm_max_pd(_mm_min_pd(t0, t1), t_enter);
+			t_exit = _mm_min_pd(_mm_max_pd(t0, t1), t_exit);
+		}
+		_mm_storeu_pd(t_near + half, t_enter);
+		t_exit = _mm_mul_pd(t_exit, _mm_set1_pd(slab_exit_scale));
+		hits |= _mm_movemask_pd(_mm_cmple_pd(t_enter, t_exit)) << half;
+	}
+	return hits;
+}
+
+RT_TARGET_AVX
+inline int wide_box_hit_avx(const wide_bounds& b, const real* origin, const real* inv_direction,
+	real t_min, real t_max, real* t_near) {
+	__m256d t_enter = _mm256_set1_pd(t_min);
+	__m256d t_exit = _mm256_set1_pd(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m256d o = _mm256_set1_pd(origin[a]);
+		__m256d inv = _mm256_set1_pd(inv_direction[a]);
+		__m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(b.min[a]), o), inv);
+		__m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(b.max[a]), o), inv);
+		t_enter = _mm256_max_pd(_mm256_min_pd(t0, t1), t_enter);
+		t_exit = _mm256_min_pd(_mm256_max_pd(t0, t1), t_exit);
+	}
+	_mm256_storeu_pd(t_near, t_enter);
+	t_exit = _mm256_mul_pd(t_exit, _mm256_set1_pd(slab_exit_scale));
+	return _mm256_movemask_pd(_mm256_cmp_pd(t_enter, t_exit, _CMP_LE_OQ));
+}
+
+inline int sphere_hit_sse2(const sphere_soa& s, int first, int count, const ray& r, real t_min, real& t_max) {
+	const __m128d sign_bit = _mm_set1_pd(-0.0);
+	const __m128d zero = _mm_setzero_pd();
+	__m128d o[3], d[3];
+	for (int a = 0; a < 3; a++) {
+		o[a] = _mm_set1_pd(r.origin()[a]);
+		d[a] = _mm_set1_pd(r.direction()[a]);
+	}
+	__m128d a = _mm_set1_pd(r.direction().length_squared());
+	__m128d lo_bound = _mm_set1_pd(t_min);
+	alignas(16) real roots[2];
+	int best = -1;
+
+	for (int i = 0; i < count; i += 2) {
+		int base = first + i;
+		__m128d oc[3];
+		for (int k = 0; k < 3; k++)
+			oc[k] = _mm_sub_pd(o[k], _mm_loadu_pd(s.center[k] + base));
+		__m128d radius = _mm_loadu_pd(s.radius + base);
+		__m128d radius2 = _mm_mul_pd(radius, radius);
+		__m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(oc[0], d[0]), _mm_mul_pd(oc[1], d[1])), _mm_mul_pd(oc[2], d[2]));
+		__m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(oc[0], oc[0]), _mm_mul_pd(oc[1], oc[1])), _mm_mul_pd(oc[2], oc[2])), radius2);
+
+		__m128d k = _mm_div_pd(half_b, a);
+		__m128d l[3];
+		for (int j = 0; j < 3; j++)
+			l[j] = _mm_sub_pd(oc[j], _mm_mul_pd(k, d[j]));
+		__m128d to_line2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(l[0], l[0]), _mm_mul_pd(l[1], l[1])), _mm_mul_pd(l[2], l[2]));
+		__m128d discriminant = _mm_mul_pd(a, _mm_sub_pd(radius2, to_line2));
+		__m128d valid = _mm_cmpge_pd(discriminant, zero);
+		if (!_mm_movemask_pd(valid))
+			continue;
+
+		// q = -(half_b + copysign(sqrt(discriminant), half_b))
+		__m128d signed_sqrt = _mm_or_pd(_mm_sqrt_pd(discriminant), _mm_and_pd(half_b, sign_bit));
+		__m128d q = _mm_xor_pd(_mm_add_pd(half_b, signed_sqrt), sign_bit);
+		__m128d r0 = _mm_div_pd(c, q);
+		__m128d r1 = _mm_div_pd(q, a);
+		__m128d q_zero = _mm_cmpeq_pd(q, zero);
+		__m128d near_root = _mm_andnot_pd(q_zero, _mm_min_pd(r0, r1));
+		__m128d far_root = _mm_andnot_pd(q_zero, _mm_max_pd(r0, r1));
+
+		__m128d hi_bound = _mm_set1_pd(t_max);
+		__m128d near_ok = _mm_and_pd(_mm_cmpge_pd(near_root, lo_bound), _mm_cmple_pd(near_root, hi_bound));
+		__m128d far_ok = _mm_and_pd(_mm_cmpge_pd(far_root, lo_bound), _mm_cmple_pd(far_root, hi_bound));
+		int mask = _mm_movemask_pd(_mm_and_pd(valid, _mm_or_pd(near_ok, far_ok)));
+		if (count - i < 2)
+			mask &= (1 << (count - i)) - 1;
+		if (!mask)
+			continue;
+
+		_mm_store_pd(roots, _mm_or_pd(_mm_and_pd(near_ok, near_root), _mm_andnot_pd(near_ok, far_root)));
+		best = sphere_pick_closest(roots, mask, base, t_max, best);
+	}
+	return best;
+}
+
+RT_TARGET_AVX
+inline int sphere_hit_avx(const sphere_soa& s, int first, int count, const ray& r, real t_min, real& t_max) {
+	const __m256d sign_bit = _mm256_set1_pd(-0.0);
+	const __m256d zero = _mm256_setzero_pd();
+	__m256d o[3], d[3];
+	for (int a = 0; a < 3; a++) {
+		o[a] = _mm256_set1_pd(r.origin()[a]);
+		d[a] = _mm256_set1_pd(r.direction()[a]);
+	}
+	__m256d a = _mm256_set1_pd(r.direction().length_squared());
+	__m256d lo_bound = _mm256_set1_pd(t_min);
+	alignas(32) real roots[4];
+	int best = -1;
+
+	for (int i = 0; i < count; i += 4) {
+		int base = first + i;
+		__m256d oc[3];
+		for (int k = 0; k < 3; k++)
+			oc[k] = _mm256_sub_pd(o[k], _mm256_loadu_pd(s.center[k] + base));
+		__m256d radius = _mm256_loadu_pd(s.radius + base);
+		__m256d radius2 = _mm256_mul_pd(radius, radius);
+		__m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], d[0]), _mm256_mul_pd(oc[1], d[1])), _mm256_mul_pd(oc[2], d[2]));
+		__m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], oc[0]), _mm256_mul_pd(oc[1], oc[1])), _mm256_mul_pd(oc[2], oc[2])), radius2);
+
+		__m256d k = _mm256_div_pd(half_b, a);
+		__m256d l[3];
+		for (int j = 0; j < 3; j++)
+			l[j] = _mm256_sub_pd(oc[j], _mm256_mul_pd(k, d[j]));
+		__m256d to_line2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(l[0], l[0]), _mm256_mul_pd(l[1], l[1])), _mm256_mul_pd(l[2], l[2]));
+		__m256d discriminant = _mm256_mul_pd(a, _mm256_sub_pd(radius2, to_line2));
+		__m256d valid = _mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ);
+		if (!_mm256_movemask_pd(valid))
+			continue;
+
+		// q = -(half_b + copysign(sqrt(discriminant), half_b))
+		__m256d signed_sqrt = _mm256_or_pd(_mm256_sqrt_pd(discriminant), _mm256_and_pd(half_b, sign_bit));
+		__m256d q = _mm256_xor_pd(_mm256_add_pd(half_b, signed_sqrt), sign_bit);
+		__m256d r0 = _mm256_div_pd(c, q);
+		__m256d r1 = _mm256_div_pd(q, a);
+		__m256d q_zero = _mm256_cmp_pd(q, zero, _CMP_EQ_OQ);
+		__m256d near_root = _mm256_andnot_pd(q_zero, _mm256_min_pd(r0, r1));
+		__m256d far_root = _mm256_andnot_pd(q_zero, _mm256_max_pd(r0, r1));
+
+		__m256d hi_bound = _mm256_set1_pd(t_max);
+		__m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(near_root, lo_bound, _CMP_GE_OQ), _mm256_cmp_pd(near_root, hi_bound, _CMP_LE_OQ));
+		__m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(far_root, lo_bound, _CMP_GE_OQ), _mm256_cmp_pd(far_root, hi_bound, _CMP_LE_OQ));
+		int mask = _mm256_movemask_pd(_mm256_and_pd(valid, _mm256_or_pd(near_ok, far_ok)));
+		if (count - i < 4)
+			mask &= (1 << (count - i)) - 1;
+		if (!mask)
+			continue;
+
+		_mm256_store_pd(roots, _mm256_or_pd(_mm256_and_pd(near_ok, near_root), _mm256_andnot_pd(near_ok, far_root)));
+		best = sphere_pick_closest(roots, mask, base, t_max, best);
+	}
+	return best;
+}
+#endif
+
+// Level of the kernels that run on a CPU with the given level
+inline simd_level kernel_simd_level(simd_level level) {
+#ifdef RT_USE_FLOAT
+	if (level == simd_level::avx)
+		return simd_level::sse2;
+#endif
+	return level;
+}
+
+typedef int (*packet_box_hit_fn)(const aabb&, const ray_packet&, int, real, const real*);
+
+inline packet_box_hit_fn packet_box_hit_kernel(simd_level level) {
+#ifdef RT_X86
+	switch (kernel_simd_level(level)) {
+#ifndef RT_USE_FLOAT
+	case simd_level::avx: return packet_box_hit_avx;
+#endif
+	case simd_level::sse2: return packet_box_hit_sse2;
+	default: break;
+	}
+#endif
+	return packet_box_hit_scalar;
+}
+
+typedef int (*wide_box_hit_fn)(const wide_bounds&, const real*, const real*, real, real, real*);
+
+inline wide_box_hit_fn wide_box_hit_kernel(simd_level level) {
+#ifdef RT_X86
+	switch (kernel_simd_level(level)) {
+#ifndef RT_USE_FLOAT
+	case simd_level::avx: return wide_box_hit_avx;
+#endif
+	case simd_level::sse2: return wide_box_hit_sse2;
+	default: break;
+	}
+#endif
+	return wide_box_hit_scalar;
+}
+
+typedef int (*sphere_hit_fn)(const sphere_soa&, int, int, const ray&, real, real&);
+
+inline sphere_hit_fn sphere_hit_kernel(simd_level level) {
+#ifdef RT_X86
+	switch (kernel_simd_level(level)) {
+#ifndef RT_USE_FLOAT
+	case simd_level::avx: return sphere_hit_avx;
+#endif
+	case simd_level::sse2: return sphere_hit_sse2;
+	default: break;
+	}
+#endif
+	return sphere_hit_scalar;
+}
+
+// Kernels used by all traversals. They start out with the best level the CPU
+// supports; select_simd_level overrides that, e.g. for comparisons.
+inline packet_box_hit_fn& packet_box_hit() {
+	static packet_box_hit_fn kernel = packet_box_hit_kernel(detect_simd_level());
+	return kernel;
+}
+
+inline wide_box_hit_fn& wide_box_hit() {
+	static wide_box_hit_fn kernel = wide_box_hit_kernel(detect_simd_level());
+	return kernel;
+}
+
+inline sphere_hit_fn& sphere_hit() {
+	static sphere_hit_fn kernel = sphere_hit_kernel(detect_simd_level());
+	return kernel;
+}
+
+inline void select_simd_level(simd_level level) {
+	packet_box_hit() = packet_box_hit_kernel(level);
+	wide_box_hit() = wide_box_hit_kernel(level);
+	sphere_hit() = sphere_hit_kernel(level);
+}
+
+#endif // !SIMD_H
@@ -1,9 +1,50 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include <utility>
+
 #include "hittable.h"
+#include "hittable_list.h"
+#include "onb.h"
 #include "vec3.h"
 
+// Distances along r to both intersections with a sphere, near_root <= far_root.
+// The discriminant comes from the distance between the center and the ray's
+// line (Ray Tracing Gems, ch. 7) rather than from b^2 - ac, and the roots are
+// taken in the form that avoids subtracting nearly equal values. Both
+// cancellations otherwise cost float renders most of their precision on big
+// or distant spheres, like the ground sphere of random_scene.
+inline bool sphere_roots(const ray& r, const point3& center, real radius, real& near_root, real& far_root) {
+	vec3 oc = r.origin() - center;
+	auto a = r.direction().length_squared();
+	auto half_b = dot(oc, r.direction());
+	auto c = oc.length_squared() - radius * radius;
+
+	vec3 to_line = oc - (half_b / a) * r.direction();
+	auto discriminant = a * (radius * radius - to_line.length_squared());
+	if (discriminant < 0)
+		return false;
+
+	auto q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+	if (q == 0) {
+		// Ray starting on the sphere and tangent to it
+		near_root = far_root = 0;
+		return true;
+	}
+
+	near_root = c / q;
+	far_root = q / a;
+	if (near_root > far_root)
+		std::swap(near_root, far_root);
+	return true;
+}
+
+// Moves a computed hit point back onto the sphere, removing most of its rounding error
+inline point3 project_to_sphere(const point3& p, const point3& center, real radius) {
+	vec3 offset = p - center;
+	return center + offset * (radius / offset.length());
+}
+
 class sphere : public hittable {
 public:
 	sphere() {}
@@ -11,17 +52,29 @@ public:
 		: center(cen), radius(r), mat_ptr(m) {};
 
 	virtual bool hit(
-		const ray& r, double tmin, double tmax, hit_record& rec) const override;
+		const ray& r, real tmin, real tmax, hit_record& rec) const override;
+	virtual void surface(const ray& r, hit_record& rec) const override;
 
 	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+	virtual double pdf_value(const point3& origin, const vec3& v) const override;
+	virtual vec3 random(const point3& origin) const override;
+
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {
+		if (mat_ptr->is_emissive())
+			lights.add(self);
+	}
+
+	virtual hittable_kind kind() const override {
+		return hittable_kind::sphere;
+	}
+
 public:
 	point3 center;
-	double radius;
+	real radius;
 	shared_ptr<material> mat_ptr;
 
-private:
-	static void get_sphere_uv(const point3& p, double& u, double& v) {
+	static void get_sphere_uv(const point3& p, real& u, real& v) {
 		// p: a given point on the sphere of radius one, centered at the origin.
 		// u: returned value [0,1] of angle around the Y axis from X=-1.
 		// v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -37,32 +90,34 @@ private:
 	}
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	vec3 oc = r.origin() - center;
-	auto a = r.direction().length_squared();
-	auto half_b = dot(oc, r.direction());
-	auto c = oc.length_squared() - radius * radius;
-
-	auto discriminant = half_b * half_b - a * c;
-	if (discriminant < 0) return false;
-	auto sqrtd = sqrt(discriminant);
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	real near_root, far_root;
+	if (!sphere_roots(r, center, radius, near_root, far_root))
+		return false;
 
 	// Find the nearest root that lies in the acceptable range
-	auto root = (-half_b - sqrtd) / a;
+	auto root = near_root;
 	if (root < t_min || t_max < root) {
-		root = (-half_b + sqrtd) / a;
+		root = far_root;
 		if (root < t_min || t_max < root)
 			return false;
 	}
 
 	rec.t = root;
-	rec.p = r.at(rec.t);
+	rec.pending = this;
+	return true;
+}
+
+void sphere::surface(const ray& r, hit_record& rec) const {
+	rec.p = project_to_sphere(r.at(rec.t), center, radius);
 	vec3 outward_normal = (rec.p - center) / radius;
 	rec.set_face_normal(r, outward_normal);
-	get_sphere_uv(outward_normal, rec.u, rec.v);
-	rec.mat_ptr = mat_ptr;
-
-	return true;
+	if (!rec.mat_ptr)
+		rec.mat_ptr = mat_ptr.get();
+	if (rec.mat_ptr->uses_uv())
+		get_sphere_uv(outward_normal, rec.u, rec.v);
+	else
+		rec.u = rec.v = 0;
 }
 
 bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
@@ -71,4 +126,40 @@ bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
 		center + vec3(radius, radius, radius));
 	return true;
 }
+
+// Sphere light sampling picks a direction uniformly inside the cone the sphere
+// covers as seen from origin. Points inside the sphere are not sampled.
+double sphere::pdf_value(const point3& origin, const vec3& v) const {
+	hit_record rec;
+	if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+		return 0;
+
+	auto distance_squared = (center - origin).length_squared();
+	if (distance_squared <= radius * radius)
+		return 0;
+
+	auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+	auto solid_angle = 2 * pi * (1 - cos_theta_max);
+
+	return 1 / solid_angle;
+}
+
+vec3 sphere::random(const point3& origin) const {
+	vec3 direction = center - origin;
+	auto distance_squared = direction.length_squared();
+	if (distance_squared <= radius * radius)
+		return direction;
+
+	auto r1 = random_double();
+	auto r2 = random_double();
+	auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
+	auto phi = 2 * pi * r1;
+	auto x = cos(phi) * sqrt(1 - z * z);
+	auto y = sin(phi) * sqrt(1 - z * z);
+
+	onb uvw;
+	uvw.build_from_w(direction);
+	return uvw.local(x, y, z);
+}
+
 #endif // !SPHERE_H
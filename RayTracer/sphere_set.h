@@ -0,0 +1,182 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "simd.h"
+#include "sphere.h"
+#include "wide_bvh.h"
+
+// Many static spheres in one primitive. Centers, radii and material indices
+// are kept in one array per component, ordered by a wide BVH over the spheres,
+// so a leaf is a contiguous range that the sphere kernel tests several spheres
+// at a time. Only the closest hit gets its hit_record filled in.
+// Add all spheres, then call build() once before rendering.
+class sphere_set : public hittable {
+public:
+	sphere_set() {}
+
+	void add(const point3& center, double radius, shared_ptr<material> m);
+
+	void build(const bvh_build_options& options = leaf_options());
+
+	int size() const { return static_cast<int>(material_index.size()); }
+
+	virtual bool hit(
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual void surface(const ray& r, hit_record& rec) const override;
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+		if (nodes.empty())
+			return false;
+		output_box = box;
+		return true;
+	}
+
+	// Emissive spheres are handed out as single spheres, light sampling needs them one by one
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override;
+
+	// Leaves hold a few SIMD batches of spheres; one batch costs about as much as a node visit
+	static bvh_build_options leaf_options() {
+		bvh_build_options options;
+		options.max_prims_in_leaf = 4;
+		options.max_sah_leaf_size = 16;
+		options.intersection_cost = 0.25;
+		return options;
+	}
+
+public:
+	std::vector<real> center[3];
+	std::vector<real> radius;
+	std::vector<int> material_index;
+	std::vector<shared_ptr<material>> materials;
+
+	std::vector<wide_bvh_node> nodes;
+	aabb box;
+	bvh_stats binary_stats;
+	wide_bvh_stats stats;
+
+	// Zeroed entries behind the last sphere, so that a kernel can load a full register
+	static const int padding = 3;
+
+private:
+	sphere_soa soa() const {
+		return { { center[0].data(), center[1].data(), center[2].data() }, radius.data() };
+	}
+
+	std::unordered_map<const material*, int> material_lookup;
+};
+
+void sphere_set::add(const point3& c, double r, shared_ptr<material> m) {
+	auto found = material_lookup.find(m.get());
+	int index;
+	if (found != material_lookup.end()) {
+		index = found->second;
+	}
+	else {
+		index = static_cast<int>(materials.size());
+		material_lookup[m.get()] = index;
+		materials.push_back(m);
+	}
+
+	for (int a = 0; a < 3; a++)
+		center[a].push_back(c[a]);
+	radius.push_back(r);
+	material_index.push_back(index);
+}
+
+void sphere_set::build(const bvh_build_options& options) {
+	int count = size();
+	std::vector<aabb> boxes(count);
+	for (int i = 0; i < count; i++) {
+		point3 c(center[0][i], center[1][i], center[2][i]);
+		vec3 extent(radius[i], radius[i], radius[i]);
+		boxes[i] = aabb(c - extent, c + extent);
+	}
+
+	bvh_builder builder(boxes, options);
+	binary_stats = builder.stats();
+
+	nodes.clear();
+	if (!builder.nodes.empty()) {
+		box = builder.nodes[0].box;
+		collapse_bvh(builder.nodes, 0, nodes);
+	}
+	stats = wide_stats(nodes);
+
+	if (options.report_stats)
+		std::cout << "sphere_set: " << binary_stats << ", " << stats << ", " << materials.size() << " materials\n";
+
+	// Store the spheres in leaf order
+	std::vector<real> sorted_center[3];
+	std::vector<real> sorted_radius;
+	std::vector<int> sorted_material;
+	for (int index : builder.prim_indices) {
+		for (int a = 0; a < 3; a++)
+			sorted_center[a].push_back(center[a][index]);
+		sorted_radius.push_back(radius[index]);
+		sorted_material.push_back(material_index[index]);
+	}
+
+	for (int a = 0; a < 3; a++) {
+		center[a] = std::move(sorted_center[a]);
+		center[a].resize(count + padding);
+	}
+	radius = std::move(sorted_radius);
+	radius.resize(count + padding);
+	material_index = std::move(sorted_material);
+}
+
+bool sphere_set::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	auto spheres_hit = sphere_hit();
+	const sphere_soa spheres = soa();
+	int best = -1;
+
+	traverse_wide_bvh(nodes, r, t_min, t_max, [&](int first, int count, real& closest) {
+		int leaf_best = spheres_hit(spheres, first, count, r, t_min, closest);
+		if (leaf_best < 0)
+			return false;
+		best = leaf_best;
+		t_max = closest;
+		return true;
+	});
+
+	if (best < 0)
+		return false;
+
+	rec.t = t_max;
+	rec.pending = this;
+	rec.primitive = best;
+	return true;
+}
+
+void sphere_set::surface(const ray& r, hit_record& rec) const {
+	int i = rec.primitive;
+	point3 c(center[0][i], center[1][i], center[2][i]);
+	rec.p = project_to_sphere(r.at(rec.t), c, radius[i]);
+	vec3 outward_normal = (rec.p - c) / radius[i];
+	rec.set_face_normal(r, outward_normal);
+	if (!rec.mat_ptr)
+		rec.mat_ptr = materials[material_index[i]].get();
+	if (rec.mat_ptr->uses_uv())
+		sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+	else
+		rec.u = rec.v = 0;
+}
+
+void sphere_set::collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const {
+	for (int i = 0; i < size(); i++) {
+		const auto& m = materials[material_index[i]];
+		if (m->is_emissive())
+			lights.add(make_shared<sphere>(point3(center[0][i], center[1][i], center[2][i]), radius[i], m));
+	}
+}
+
+#endif // !SPHERE_SET_H
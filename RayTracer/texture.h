@@ -4,12 +4,27 @@
 #include "rtcommon.h"
 #include "rt_stb_image.h"
 #include "perlin.h"
+#include "scene_cache.h"
 
 #include <iostream>
 
+// The textures compiled_scene evaluates without virtual calls
+enum class texture_kind { other, solid_color, checker, noise, image };
+
 class texture {
 public:
 	virtual color value(double u, double v, const point3& p) const = 0;
+
+	// Whether value depends on u and v. Hits on surfaces whose materials
+	// only use textures that don't are spared computing them.
+	virtual bool uses_uv() const {
+		return false;
+	}
+
+	// Concrete type for compiled_scene, other if it doesn't know it
+	virtual texture_kind kind() const {
+		return texture_kind::other;
+	}
 };
 
 class solid_color : public texture {
@@ -23,6 +38,10 @@ public:
 		return color_value;
 	}
 
+	virtual texture_kind kind() const override {
+		return texture_kind::solid_color;
+	}
+
 private:
 	color color_value;
 };
@@ -38,13 +57,26 @@ public:
 		: even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)) {}
 
 	virtual color value(double u, double v, const point3& p) const override {
-		auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
-		if (sines < 0)
+		if (is_odd(p))
 			return odd->value(u, v, p);
 		else
 			return even->value(u, v, p);
 	}
 
+	virtual bool uses_uv() const override {
+		return odd->uses_uv() || even->uses_uv();
+	}
+
+	virtual texture_kind kind() const override {
+		return texture_kind::checker;
+	}
+
+	// Whether p lies in a cell of the odd texture
+	static bool is_odd(const point3& p) {
+		auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+		return sines < 0;
+	}
+
 public:
 	shared_ptr<texture> odd;
 	shared_ptr<texture> even;
@@ -59,6 +91,10 @@ public:
 		return color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p)));
 	}
 
+	virtual texture_kind kind() const override {
+		return texture_kind::noise;
+	}
+
 public:
 	perlin noise;
 	double scale;
@@ -71,22 +107,58 @@ public:
 	image_texture()
 		: data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
 
+	// The decoded texels are kept in a scene cache next to the image file, so
+	// later runs map them instead of decoding the image again
 	image_texture(const char* filename) {
 		auto components_per_pixel = bytes_per_pixel;
+		std::string cache_path = scene_cache_path(filename);
+		uint64_t key = scene_cache_enabled() ? scene_cache_key(filename) : 0;
+
+		// Sections: width and height, texels
+		scene_cache_reader reader;
+		if (key != 0 && reader.open(cache_path, key, 2)) {
+			auto size = reader.section<int>(0);
+			auto texels = reader.section<unsigned char>(1);
+			if (size.size == 2 && texels.size == static_cast<size_t>(size[0]) * size[1] * bytes_per_pixel) {
+				width = size[0];
+				height = size[1];
+				data = texels.data;
+				mapping = reader.file;
+				bytes_per_scanline = bytes_per_pixel * width;
+				return;
+			}
+		}
 
-		data = stbi_load(
+		decoded = stbi_load(
 			filename, &width, &height, &components_per_pixel, components_per_pixel);
+		data = decoded;
 
 		if (!data) {
 			std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
 			width = height = 0;
 		}
+		else if (key != 0) {
+			int size[2] = { width, height };
+			scene_cache_writer writer;
+			writer.add(size, 2);
+			writer.add(data, static_cast<size_t>(width) * height * bytes_per_pixel);
+			if (!writer.write(cache_path, key))
+				std::cerr << "WARNING: Could not write scene cache '" << cache_path << "'.\n";
+		}
 
 		bytes_per_scanline = bytes_per_pixel * width;
 	}
 
 	~image_texture() {
-		delete data;
+		stbi_image_free(decoded);
+	}
+
+	virtual bool uses_uv() const override {
+		return true;
+	}
+
+	virtual texture_kind kind() const override {
+		return texture_kind::image;
 	}
 
 	virtual color value(double u, double v, const vec3& p) const override {
@@ -112,9 +184,12 @@ public:
 	}
 
 private:
-	unsigned char* data;
+	const unsigned char* data;
 	int width, height;
 	int bytes_per_scanline;
+
+	unsigned char* decoded = nullptr;		// owned by stb_image, if the image was decoded
+	shared_ptr<mapped_file> mapping;		// the cache data points into, if it was mapped
 };
 
 #endif // !TEXTURE_H
@@ -0,0 +1,176 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rtcommon.h"
+
+// Square block of pixels, [x0, x1) x [y0, y1)
+struct tile {
+	int x0, y0;
+	int x1, y1;
+};
+
+// Splits the image into tiles and renders them on a fixed set of workers.
+// Every worker owns a deque of tiles; it takes work from the front of its own
+// deque and, once that runs dry, steals from the back of the others. Tiles are
+// handed out in a spiral from the image center, so the interesting part of
+// the frame finishes first and each worker stays in a small neighbourhood.
+class tile_scheduler {
+public:
+	tile_scheduler(int image_width, int image_height, int tile_size, int num_workers)
+		: worker_count(std::max(1, num_workers))
+		, queues(worker_count)
+	{
+		tile_size = std::max(1, tile_size);
+		for (int y = 0; y < image_height; y += tile_size)
+			for (int x = 0; x < image_width; x += tile_size)
+				tiles.push_back({ x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height) });
+
+		// Spiral order: by square ring around the center, then by angle inside a ring
+		double cx = image_width / 2.0;
+		double cy = image_height / 2.0;
+		auto ring = [&](const tile& t) {
+			double dx = (t.x0 + t.x1) / 2.0 - cx;
+			double dy = (t.y0 + t.y1) / 2.0 - cy;
+			return static_cast<int>(std::max(std::fabs(dx), std::fabs(dy)) / tile_size);
+		};
+		auto angle = [&](const tile& t) {
+			return std::atan2((t.y0 + t.y1) / 2.0 - cy, (t.x0 + t.x1) / 2.0 - cx);
+		};
+		std::stable_sort(tiles.begin(), tiles.end(), [&](const tile& a, const tile& b) {
+			int ra = ring(a), rb = ring(b);
+			return ra != rb ? ra < rb : angle(a) < angle(b);
+		});
+
+		timings.resize(tiles.size());
+		worker_busy_ms.resize(worker_count);
+	}
+
+	// Calls render_tile(tile) for every tile and returns once all of them are done.
+	// Can be called repeatedly, e.g. once per progressive pass; timings add up.
+	template<class F>
+	void run(F render_tile) {
+		// Deal the tiles out round-robin, so every worker starts near the center
+		for (size_t i = 0; i < tiles.size(); i++)
+			queues[i % worker_count].tiles.push_back(static_cast<int>(i));
+
+		std::vector<std::thread> workers;
+		for (int w = 0; w < worker_count; w++)
+			workers.emplace_back([this, w, &render_tile] { work(w, render_tile); });
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	void print_timings(std::ostream& out) const {
+		if (timings.empty())
+			return;
+
+		double total = 0, shortest = infinity, longest = 0;
+		int stolen = 0;
+		for (const auto& t : timings) {
+			total += t.ms;
+			shortest = std::min(shortest, t.ms);
+			longest = std::max(longest, t.ms);
+			stolen += t.stolen;
+		}
+
+		double mean = total / timings.size();
+		auto busiest = std::minmax_element(worker_busy_ms.begin(), worker_busy_ms.end());
+
+		out << "Tiles: " << timings.size() << ", " << stolen << " stolen\n"
+			<< "Tile time (ms): min " << shortest << ", mean " << mean << ", max " << longest
+			<< " (max/mean " << longest / mean << ")\n"
+			<< "Worker busy time (ms): min " << *busiest.first << ", max " << *busiest.second << "\n";
+	}
+
+	// One line per tile, in scheduling order
+	void write_timings(const std::string& filename) const {
+		std::ofstream file(filename);
+		file << "x0,y0,x1,y1,worker,stolen,ms\n";
+		for (size_t i = 0; i < tiles.size(); i++) {
+			const auto& t = tiles[i];
+			file << t.x0 << ',' << t.y0 << ',' << t.x1 << ',' << t.y1 << ','
+				<< timings[i].worker << ',' << timings[i].stolen << ',' << timings[i].ms << '\n';
+		}
+	}
+
+public:
+	std::vector<tile> tiles;
+
+private:
+	struct work_queue {
+		std::mutex mutex;
+		std::deque<int> tiles;
+	};
+
+	struct tile_timing {
+		int worker = 0;		// worker that rendered the tile last
+		int stolen = 0;		// number of runs in which the tile got stolen
+		double ms = 0;
+	};
+
+	template<class F>
+	void work(int self, F& render_tile) {
+		while (true) {
+			bool stolen = false;
+			int index = pop_front(self);
+
+			for (int i = 1; index < 0 && i < worker_count; i++) {
+				index = pop_back((self + i) % worker_count);
+				stolen = index >= 0;
+			}
+
+			// Tiles are never added while running, so empty queues everywhere means done
+			if (index < 0)
+				return;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			render_tile(tiles[index]);
+			auto stop = std::chrono::high_resolution_clock::now();
+
+			timings[index].worker = self;
+			timings[index].stolen += stolen ? 1 : 0;
+			double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+			timings[index].ms += ms;
+			worker_busy_ms[self] += ms;
+		}
+	}
+
+	int pop_front(int queue_index) {
+		auto& q = queues[queue_index];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tiles.empty())
+			return -1;
+		int index = q.tiles.front();
+		q.tiles.pop_front();
+		return index;
+	}
+
+	int pop_back(int queue_index) {
+		auto& q = queues[queue_index];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tiles.empty())
+			return -1;
+		int index = q.tiles.back();
+		q.tiles.pop_back();
+		return index;
+	}
+
+	int worker_count;
+	std::vector<work_queue> queues;
+	std::vector<tile_timing> timings;
+	std::vector<double> worker_busy_ms;
+};
+
+#endif // !TILE_SCHEDULER_H
@@ -0,0 +1,145 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cmath>
+#include <iostream>
+
+#include "rtcommon.h"
+
+#include "aabb.h"
+#include "vec3.h"
+
+// Affine transform stored as the top three rows of a 4x4 matrix: a linear
+// part m[0..2][0..2] and a translation m[0..2][3].
+class affine_transform {
+public:
+	affine_transform() {
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 4; j++)
+				m[i][j] = i == j ? 1 : 0;
+	}
+
+	static affine_transform translation(const vec3& offset) {
+		affine_transform t;
+		for (int i = 0; i < 3; i++)
+			t.m[i][3] = offset[i];
+		return t;
+	}
+
+	static affine_transform scaling(const vec3& factors) {
+		affine_transform t;
+		for (int i = 0; i < 3; i++)
+			t.m[i][i] = factors[i];
+		return t;
+	}
+
+	static affine_transform scaling(double factor) {
+		return scaling(vec3(factor, factor, factor));
+	}
+
+	// Counterclockwise rotation about axis, looking down the axis towards the origin
+	static affine_transform rotation(const vec3& axis, double degrees) {
+		vec3 a = unit_vector(axis);
+		double radians = degrees_to_radians(degrees);
+		double s = sin(radians), c = cos(radians);
+
+		affine_transform t;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++)
+				t.m[i][j] = static_cast<real>(a[i] * a[j] * (1 - c) + (i == j ? c : 0));
+		}
+		t.m[0][1] -= static_cast<real>(a[2] * s);
+		t.m[0][2] += static_cast<real>(a[1] * s);
+		t.m[1][0] += static_cast<real>(a[2] * s);
+		t.m[1][2] -= static_cast<real>(a[0] * s);
+		t.m[2][0] -= static_cast<real>(a[1] * s);
+		t.m[2][1] += static_cast<real>(a[0] * s);
+		return t;
+	}
+
+	point3 point(const point3& p) const {
+		return point3(
+			m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+			m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+			m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+	}
+
+	vec3 vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+			m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+			m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+	}
+
+	// Multiplies v with the transposed linear part. Called on the inverse
+	// transform, this carries normals along, since they transform with the
+	// inverse transpose.
+	vec3 transposed_vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+			m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+			m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+	}
+
+	affine_transform inverse() const {
+		affine_transform inv;
+		// Inverse of the linear part from its cofactors
+		real det =
+			m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+			m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+			m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+		if (det == 0) {
+			std::cerr << "ERROR: Singular transform has no inverse.\n";
+			return inv;
+		}
+
+		real inv_det = 1 / det;
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				int i1 = (j + 1) % 3, i2 = (j + 2) % 3;
+				int j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+				inv.m[i][j] = (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) * inv_det;
+			}
+		}
+
+		// The translation is undone after the linear part
+		vec3 offset = inv.vector(vec3(m[0][3], m[1][3], m[2][3]));
+		for (int i = 0; i < 3; i++)
+			inv.m[i][3] = -offset[i];
+		return inv;
+	}
+
+	// Box around the transformed corners of box
+	aabb box(const aabb& b) const {
+		point3 min(infinity, infinity, infinity);
+		point3 max(-infinity, -infinity, -infinity);
+		for (int corner = 0; corner < 8; corner++) {
+			point3 p = point(point3(
+				corner & 1 ? b.max().x() : b.min().x(),
+				corner & 2 ? b.max().y() : b.min().y(),
+				corner & 4 ? b.max().z() : b.min().z()));
+			for (int a = 0; a < 3; a++) {
+				min[a] = fmin(min[a], p[a]);
+				max[a] = fmax(max[a], p[a]);
+			}
+		}
+		return aabb(min, max);
+	}
+
+public:
+	real m[3][4];
+};
+
+// a * b applies b first, then a
+inline affine_transform operator * (const affine_transform& a, const affine_transform& b) {
+	affine_transform t;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			t.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j]
+				+ (j == 3 ? a.m[i][3] : 0);
+		}
+	}
+	return t;
+}
+
+#endif // !TRANSFORM_H
@@ -0,0 +1,345 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "rtcommon.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "scene_cache.h"
+#include "wide_bvh.h"
+
+// Per-ray constants of the watertight ray/triangle test (Woop, Benthin, Wald,
+// "Watertight Ray/Triangle Intersection", JCGT 2013). The ray is sheared and
+// scaled so that it runs along +z from the origin, which reduces the test to
+// 2D edge functions evaluated the same way for every triangle sharing an edge.
+struct watertight_ray {
+	explicit watertight_ray(const ray& r) : origin(r.origin()) {
+		const vec3& d = r.direction();
+		kz = 0;
+		if (fabs(d[1]) > fabs(d[kz])) kz = 1;
+		if (fabs(d[2]) > fabs(d[kz])) kz = 2;
+		kx = kz == 2 ? 0 : kz + 1;
+		ky = kx == 2 ? 0 : kx + 1;
+		// Keep the winding of the triangles
+		if (d[kz] < 0)
+			std::swap(kx, ky);
+
+		sx = d[kx] / d[kz];
+		sy = d[ky] / d[kz];
+		sz = 1 / d[kz];
+	}
+
+	// Distance to triangle p0 p1 p2 and the barycentric weights of its
+	// vertices, if the ray hits it within [t_min, t_max]
+	bool hit(const point3& p0, const point3& p1, const point3& p2, real t_min, real t_max,
+		real& t, real& b0, real& b1, real& b2) const {
+		vec3 a = p0 - origin;
+		vec3 b = p1 - origin;
+		vec3 c = p2 - origin;
+
+		real ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+		real bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+		real cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+
+		real u = cx * by - cy * bx;
+		real v = ax * cy - ay * cx;
+		real w = bx * ay - by * ax;
+
+		// A ray through an edge or vertex gives exactly zero; redo those in
+		// double so that float builds don't let it slip between two triangles
+		if (sizeof(real) < sizeof(double) && (u == 0 || v == 0 || w == 0)) {
+			u = static_cast<real>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+			v = static_cast<real>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+			w = static_cast<real>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+		}
+
+		if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+			return false;
+
+		real det = u + v + w;
+		if (det == 0)
+			return false;
+
+		real az = sz * a[kz], bz = sz * b[kz], cz = sz * c[kz];
+		real inv_det = 1 / det;
+		t = (u * az + v * bz + w * cz) * inv_det;
+		if (!(t >= t_min && t <= t_max))
+			return false;
+
+		b0 = u * inv_det;
+		b1 = v * inv_det;
+		b2 = w * inv_det;
+		return true;
+	}
+
+	point3 origin;
+	int kx, ky, kz;
+	real sx, sy, sz;
+};
+
+// Indexed triangle mesh. Positions, normals and UVs are shared by all the
+// triangles that use a vertex; a triangle itself is just three vertex indices,
+// so the only per-triangle objects are its indices and its share of the BVH.
+// Fill the buffers (or use load_obj), then call build() once before rendering.
+// A built mesh can be written to a scene cache and later mapped back with
+// load_cache, which leaves the buffers empty and reads the file in place.
+class triangle_mesh : public hittable {
+public:
+	triangle_mesh() {}
+	triangle_mesh(shared_ptr<material> m) : mat_ptr(m) {}
+
+	int vertex_count() const { return static_cast<int>(position_view.size); }
+	int triangle_count() const { return static_cast<int>(index_view.size / 3); }
+
+	void build(const bvh_build_options& options = leaf_options());
+
+	// Key of a cache for the mesh built from a source with key source_key
+	static uint64_t cache_key(uint64_t source_key, const bvh_build_options& options);
+
+	bool write_cache(const std::string& path, uint64_t key) const;
+	bool load_cache(const std::string& path, uint64_t key);
+
+	virtual bool hit(
+		const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual void surface(const ray& r, hit_record& rec) const override;
+
+	virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+		if (node_view.empty())
+			return false;
+		output_box = box;
+		return true;
+	}
+
+	// Emissive meshes are not sampled by next event estimation; they still
+	// light the scene through the paths that hit them
+	virtual void collect_lights(const shared_ptr<hittable>& self, hittable_list& lights) const override {}
+
+	// Bytes held per triangle, vertex buffers and BVH included
+	double bytes_per_triangle() const;
+
+	static bvh_build_options leaf_options() {
+		bvh_build_options options;
+		options.max_prims_in_leaf = 4;
+		return options;
+	}
+
+public:
+	std::vector<point3> positions;
+	std::vector<vec3> normals;		// one per vertex, or empty for flat shading
+	std::vector<real> uvs;			// two per vertex, or empty to use the barycentric coordinates
+	std::vector<int> indices;		// three per triangle, in leaf order after build()
+	shared_ptr<material> mat_ptr;
+
+	std::vector<wide_bvh_node> nodes;
+	aabb box;
+	bvh_stats binary_stats;
+	wide_bvh_stats stats;
+
+	// What hit() reads: the buffers above, or the arrays of a mapped cache
+	array_view<point3> position_view;
+	array_view<vec3> normal_view;
+	array_view<real> uv_view;
+	array_view<int> index_view;
+	array_view<wide_bvh_node> node_view;
+	shared_ptr<mapped_file> mapping;
+
+private:
+	void use_buffers() {
+		position_view = positions;
+		normal_view = normals;
+		uv_view = uvs;
+		index_view = indices;
+		node_view = nodes;
+		mapping = nullptr;
+	}
+};
+
+void triangle_mesh::build(const bvh_build_options& options) {
+	int count = static_cast<int>(indices.size() / 3);
+	std::vector<aabb> boxes(count);
+	for (int i = 0; i < count; i++) {
+		const point3& p0 = positions[indices[3 * i]];
+		const point3& p1 = positions[indices[3 * i + 1]];
+		const point3& p2 = positions[indices[3 * i + 2]];
+		point3 lo, hi;
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(p0[a], std::min(p1[a], p2[a]));
+			hi[a] = std::max(p0[a], std::max(p1[a], p2[a]));
+		}
+		boxes[i] = aabb(lo, hi);
+	}
+
+	bvh_builder builder(boxes, options);
+	binary_stats = builder.stats();
+
+	nodes.clear();
+	if (!builder.nodes.empty()) {
+		box = builder.nodes[0].box;
+		collapse_bvh(builder.nodes, 0, nodes);
+	}
+	stats = wide_stats(nodes);
+
+	// Store the triangles in leaf order
+	std::vector<int> sorted(indices.size());
+	for (int i = 0; i < count; i++) {
+		int index = builder.prim_indices[i];
+		for (int k = 0; k < 3; k++)
+			sorted[3 * i + k] = indices[3 * index + k];
+	}
+	indices = std::move(sorted);
+	use_buffers();
+
+	if (options.report_stats)
+		std::cout << "triangle_mesh: " << binary_stats << ", " << stats << ", "
+			<< bytes_per_triangle() << " bytes per triangle\n";
+}
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	const watertight_ray wr(r);
+	int best = -1;
+	real best_b0 = 0, best_b1 = 0, best_b2 = 0;
+
+	traverse_wide_bvh(node_view, r, t_min, t_max, [&](int first, int count, real& closest) {
+		bool hit_leaf = false;
+		for (int i = first; i < first + count; i++) {
+			real t, b0, b1, b2;
+			if (wr.hit(position_view[index_view[3 * i]], position_view[index_view[3 * i + 1]], position_view[index_view[3 * i + 2]],
+				t_min, closest, t, b0, b1, b2)) {
+				closest = t;
+				best = i;
+				best_b0 = b0;
+				best_b1 = b1;
+				best_b2 = b2;
+				hit_leaf = true;
+			}
+		}
+		if (hit_leaf)
+			t_max = closest;
+		return hit_leaf;
+	});
+
+	if (best < 0)
+		return false;
+
+	rec.t = t_max;
+	rec.pending = this;
+	rec.primitive = best;
+	rec.b0 = best_b0;
+	rec.b1 = best_b1;
+	rec.b2 = best_b2;
+	return true;
+}
+
+void triangle_mesh::surface(const ray& r, hit_record& rec) const {
+	int i0 = index_view[3 * rec.primitive], i1 = index_view[3 * rec.primitive + 1], i2 = index_view[3 * rec.primitive + 2];
+	const point3& p0 = position_view[i0];
+	const point3& p1 = position_view[i1];
+	const point3& p2 = position_view[i2];
+
+	// The barycentric point lies on the triangle, r.at(t) only close to it
+	rec.p = rec.b0 * p0 + rec.b1 * p1 + rec.b2 * p2;
+	rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+
+	if (!normal_view.empty()) {
+		// Interpolated normal, turned to the side the ray comes from. Corners
+		// of faces the file gave no normals have zero ones; a triangle without
+		// any keeps the geometric normal.
+		vec3 shading = rec.b0 * normal_view[i0] + rec.b1 * normal_view[i1] + rec.b2 * normal_view[i2];
+		if (shading.length_squared() > 0) {
+			shading = unit_vector(shading);
+			rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+		}
+	}
+
+	if (!rec.mat_ptr)
+		rec.mat_ptr = mat_ptr.get();
+	if (!rec.mat_ptr->uses_uv()) {
+		rec.u = rec.v = 0;
+	}
+	else if (!uv_view.empty()) {
+		rec.u = rec.b0 * uv_view[2 * i0] + rec.b1 * uv_view[2 * i1] + rec.b2 * uv_view[2 * i2];
+		rec.v = rec.b0 * uv_view[2 * i0 + 1] + rec.b1 * uv_view[2 * i1 + 1] + rec.b2 * uv_view[2 * i2 + 1];
+	}
+	else {
+		rec.u = rec.b1;
+		rec.v = rec.b2;
+	}
+}
+
+double triangle_mesh::bytes_per_triangle() const {
+	if (index_view.empty())
+		return 0;
+	double bytes = position_view.size * sizeof(point3) + normal_view.size * sizeof(vec3)
+		+ uv_view.size * sizeof(real) + index_view.size * sizeof(int)
+		+ node_view.size * sizeof(wide_bvh_node);
+	return bytes / triangle_count();
+}
+
+uint64_t triangle_mesh::cache_key(uint64_t source_key, const bvh_build_options& options) {
+	uint64_t key = hash_value(static_cast<uint32_t>(sizeof(wide_bvh_node)), source_key);
+	key = hash_value(options.split_method, key);
+	key = hash_value(options.max_prims_in_leaf, key);
+	key = hash_value(options.max_sah_leaf_size, key);
+	key = hash_value(options.traversal_cost, key);
+	key = hash_value(options.intersection_cost, key);
+	key = hash_value(options.sah_bins, key);
+	return key;
+}
+
+// Sections: box, BVH stats, positions, normals, UVs, indices, nodes
+bool triangle_mesh::write_cache(const std::string& path, uint64_t key) const {
+	scene_cache_writer writer;
+	writer.add(&box, 1);
+	writer.add(&binary_stats, 1);
+	writer.add(&stats, 1);
+	writer.add(position_view.data, position_view.size);
+	writer.add(normal_view.data, normal_view.size);
+	writer.add(uv_view.data, uv_view.size);
+	writer.add(index_view.data, index_view.size);
+	writer.add(node_view.data, node_view.size);
+	return writer.write(path, key);
+}
+
+bool triangle_mesh::load_cache(const std::string& path, uint64_t key) {
+	scene_cache_reader reader;
+	if (!reader.open(path, key, 8))
+		return false;
+
+	auto cached_box = reader.section<aabb>(0);
+	auto cached_binary_stats = reader.section<bvh_stats>(1);
+	auto cached_stats = reader.section<wide_bvh_stats>(2);
+	auto cached_positions = reader.section<point3>(3);
+	auto cached_normals = reader.section<vec3>(4);
+	auto cached_uvs = reader.section<real>(5);
+	auto cached_indices = reader.section<int>(6);
+	auto cached_nodes = reader.section<wide_bvh_node>(7);
+	if (cached_box.size != 1 || cached_binary_stats.size != 1 || cached_stats.size != 1
+		|| (!cached_normals.empty() && cached_normals.size != cached_positions.size)
+		|| (!cached_uvs.empty() && cached_uvs.size != 2 * cached_positions.size)
+		|| cached_indices.size % 3 != 0 || cached_nodes.empty() != cached_indices.empty())
+		return false;
+
+	positions.clear();
+	normals.clear();
+	uvs.clear();
+	indices.clear();
+	nodes.clear();
+
+	box = cached_box[0];
+	binary_stats = cached_binary_stats[0];
+	stats = cached_stats[0];
+	position_view = cached_positions;
+	normal_view = cached_normals;
+	uv_view = cached_uvs;
+	index_view = cached_indices;
+	node_view = cached_nodes;
+	mapping = reader.file;
+	return true;
+}
+
+#endif // !TRIANGLE_MESH_H